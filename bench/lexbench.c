@@ -0,0 +1,62 @@
+#include <time.h>
+
+#include "../shell.h"
+
+/*
+ * Tokenizer microbenchmark. Generates a single command line of the given
+ * size in kilobytes (default 256), made of words of 1 to maxword (default 32)
+ * characters separated by blanks and operators, then splits it into tokens
+ * repeatedly. Usage: bench/lexbench [kilobytes] [iterations] [maxword]
+ */
+
+static char *genline(size_t size, size_t maxword)
+{
+  static const char *seps[] = {" ", "  ", "\t", " | ", " > ", " && ", "; "};
+  char *line = malloc(size + 1);
+  unsigned seed = 1;
+  size_t n = 0;
+
+  while (n < size)
+  {
+    seed = seed * 1103515245 + 12345;
+    size_t len = 1 + (seed >> 16) % maxword;
+    for (size_t i = 0; i < len && n < size; i++)
+      line[n++] = 'a' + (seed >> (i % 16)) % 26;
+    const char *sep = seps[(seed >> 8) % 7];
+    while (*sep && n < size)
+      line[n++] = *sep++;
+  }
+  line[n] = '\0';
+  return line;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+  size_t size = (argc > 1 ? atol(argv[1]) : 256) * 1024;
+  int iters = argc > 2 ? atoi(argv[2]) : 200;
+  size_t maxword = argc > 3 ? atol(argv[3]) : 32;
+  char *line = genline(size, maxword);
+  arena_t arena = {};
+  int ntokens = 0;
+
+  double start = now();
+  for (int i = 0; i < iters; i++)
+  {
+    tokenize(&arena, line, size, &ntokens);
+    arena_reset(&arena);
+  }
+  double elapsed = now() - start;
+
+  printf("lexer: %zuKB line, words up to %zu, %d tokens, %.0f MB/s\n",
+         size / 1024, maxword, ntokens, size * (double)iters / elapsed / 1e6);
+  arena_destroy(&arena);
+  free(line);
+  return 0;
+}
@@ -0,0 +1,7 @@
+#!/bin/sh
+# Measure tokenizer throughput on generated command lines of growing length.
+# Usage: bench/lexer.sh [shell] (shell is ignored, lexer is linked in)
+
+for kb in 1 16 256 1024; do
+  "$(dirname "$0")/lexbench" $kb $((262144 / kb))
+done
@@ -0,0 +1,27 @@
+#!/bin/sh
+# Measure throughput of pipelines of cat stages moving SIZE (default 512)
+# megabytes, with default, largest and adaptively grown pipes.
+# Usage: bench/pipe.sh [shell] [SIZE]
+
+SHELL_UNDER_TEST=$(realpath "${1:-./shell}")
+SIZE=${2:-512}
+
+for mode in default max adaptive; do
+  case $mode in
+    adaptive) setting="default -a" ;;
+    *) setting=$mode ;;
+  esac
+  for n in 1 2 4 8; do
+    pipeline="head -c ${SIZE}M /dev/zero"
+    i=0
+    while [ $i -lt $n ]; do
+      pipeline="$pipeline | cat"
+      i=$((i + 1))
+    done
+    start=$(date +%s.%N)
+    "$SHELL_UNDER_TEST" -c "pipesize $setting; $pipeline > /dev/null"
+    finish=$(date +%s.%N)
+    echo "$mode $n $SIZE $start $finish" | awk '{
+      printf "pipe: %-8s %d stages %7.0f MB/s\n", $1, $2 + 1, $3 / ($5 - $4) }'
+  done
+done
@@ -0,0 +1,37 @@
+#!/bin/sh
+# Stress reaping of children: start J (default 500) background pipelines of
+# 20 sleeps each, so about 10k children exit at once, and report CPU time the
+# shell itself spent, sampled from /proc while it runs.
+# Usage: bench/reap.sh [shell] [J]
+
+SHELL_UNDER_TEST=$(realpath "${1:-./shell}")
+J=${2:-500}
+SECS=$((J / 25 + 5))
+SCRIPT=$(mktemp)
+trap 'rm -f "$SCRIPT"' EXIT
+
+stage="sleep $SECS"
+pipeline=$stage
+i=1
+while [ $i -lt 20 ]; do
+  pipeline="$pipeline | $stage"
+  i=$((i + 1))
+done
+i=0
+while [ $i -lt "$J" ]; do
+  echo "$pipeline &"
+  i=$((i + 1))
+done > "$SCRIPT"
+echo "sleep $((SECS + 5))" >> "$SCRIPT"
+
+"$SHELL_UNDER_TEST" "$SCRIPT" > /dev/null &
+pid=$!
+ticks=0
+while stat=$(cat /proc/$pid/stat 2>/dev/null) && [ -n "$stat" ]; do
+  ticks=$(echo "${stat##*) }" | awk '{ print $12 + $13 }')
+  sleep 0.1
+done
+wait $pid
+
+echo "$J $ticks $(getconf CLK_TCK)" |
+  awk '{ printf "reap: %d children, shell cpu %.2fs\n", $1 * 20, $2 / $3 }'
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Measure how many external commands per second the shell starts and waits
+# for, running a script of N (default 2000) invocations of /bin/true.
+# Usage: bench/spawn.sh [shell] [N]
+
+SHELL_UNDER_TEST=$(realpath "${1:-./shell}")
+N=${2:-2000}
+SCRIPT=$(mktemp)
+trap 'rm -f "$SCRIPT"' EXIT
+
+i=0
+while [ $i -lt "$N" ]; do
+  echo /bin/true
+  i=$((i + 1))
+done > "$SCRIPT"
+
+start=$(date +%s.%N)
+"$SHELL_UNDER_TEST" "$SCRIPT"
+finish=$(date +%s.%N)
+
+echo "$N $start $finish" |
+  awk '{ t = $3 - $2; printf "spawn: %d commands in %.3fs, %.0f/s\n", $1, t, $1 / t }'
@@ -0,0 +1,27 @@
+#!/bin/sh
+# Measure startup latency of the shell: run 'shell -c true' N (default 10000)
+# times, and /bin/true as many times for comparison. The difference is what
+# the shell adds on top of starting a process.
+# Usage: bench/startup.sh [shell] [N]
+
+SHELL_UNDER_TEST=$(realpath "${1:-./shell}")
+N=${2:-10000}
+
+run() {
+  start=$(date +%s.%N)
+  i=0
+  while [ $i -lt "$N" ]; do
+    "$@"
+    i=$((i + 1))
+  done
+  finish=$(date +%s.%N)
+  echo "$start $finish"
+}
+
+base=$(run /bin/true)
+shell=$(run "$SHELL_UNDER_TEST" -c true)
+
+echo "$N $base $shell" | awk '{
+  b = ($3 - $2) / $1 * 1e6; s = ($5 - $4) / $1 * 1e6
+  printf "startup: %d runs, %.0fus per shell -c true, %.0fus per /bin/true\n",
+         $1, s, b }'
@@ -0,0 +1,26 @@
+#!/bin/sh
+# Count system calls needed to set up a pipeline stage: made by the shell,
+# and by a child before it executes its command. Difference between pipelines
+# of 21 stages and of a single one is divided by the 20 extra stages.
+# Usage: bench/syscalls.sh [shell]
+
+SHELL_UNDER_TEST=$(realpath "${1:-./shell}")
+SYSCOUNT=$(dirname "$0")/syscount
+OUT=$(mktemp)
+trap 'rm -f "$OUT"' EXIT
+
+pipeline=true
+i=1
+while [ $i -lt 21 ]; do
+  pipeline="$pipeline | true"
+  i=$((i + 1))
+done
+
+"$SYSCOUNT" -o "$OUT" "$SHELL_UNDER_TEST" -c true
+one=$(cat "$OUT")
+"$SYSCOUNT" -o "$OUT" "$SHELL_UNDER_TEST" -c "$pipeline"
+many=$(cat "$OUT")
+
+echo "$one $many" | awk '{
+  printf "syscalls: %.1f per stage in shell, %.1f in child before exec\n",
+         ($3 - $1) / 20, ($4 - $2) / 20 }'
@@ -0,0 +1,110 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <linux/ptrace.h>
+
+/*
+ * Count system calls made by a command, and separately by its children up to
+ * the moment they call execve, i.e. the cost of starting processes rather
+ * than of running them. Children that never call execve are counted whole.
+ * Usage: bench/syscount [-o file] command [args...]
+ */
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: syscount [-o file] command [args...]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  FILE *out = stderr;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "+o:")) != -1)
+  {
+    if (opt != 'o' || (out = fopen(optarg, "w")) == NULL)
+      usage();
+  }
+  if (optind == argc)
+    usage();
+
+  pid_t pid = fork();
+  if (pid < 0)
+  {
+    perror("fork");
+    return 1;
+  }
+  if (pid == 0)
+  {
+    ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+    raise(SIGSTOP);
+    execvp(argv[optind], &argv[optind]);
+    perror(argv[optind]);
+    _exit(127);
+  }
+
+  int status;
+  waitpid(pid, &status, 0);
+  ptrace(PTRACE_SETOPTIONS, pid, NULL,
+         PTRACE_O_TRACESYSGOOD | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK |
+           PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL);
+  ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+
+  unsigned long parent = 0, children = 0;
+  int exitcode = 0;
+  bool started = false; /* command itself has been executed */
+  pid_t w;
+
+  while ((w = waitpid(-1, &status, __WALL)) > 0)
+  {
+    if (WIFEXITED(status) || WIFSIGNALED(status))
+    {
+      if (w == pid)
+        exitcode = WIFEXITED(status) ? WEXITSTATUS(status) : 128;
+      continue;
+    }
+
+    int sig = WSTOPSIG(status);
+    int event = status >> 16;
+
+    if (sig == (SIGTRAP | 0x80))
+    {
+      struct ptrace_syscall_info info;
+      if (ptrace(PTRACE_GET_SYSCALL_INFO, w, sizeof(info), &info) > 0 &&
+          info.op == PTRACE_SYSCALL_INFO_ENTRY)
+      {
+        if (w == pid)
+          parent++;
+        else
+          children++;
+      }
+      sig = 0;
+    }
+    else if (event == PTRACE_EVENT_EXEC)
+    {
+      if (w != pid || started)
+      {
+        ptrace(PTRACE_DETACH, w, NULL, NULL);
+        continue;
+      }
+      started = true;
+      sig = 0;
+    }
+    else if (event != 0 || sig == SIGSTOP)
+    {
+      /* Fork, vfork and clone events, and the initial stop of a new child. */
+      sig = 0;
+    }
+    ptrace(PTRACE_SYSCALL, w, NULL, sig);
+  }
+
+  fprintf(out, "%lu %lu\n", parent, children);
+  return exitcode;
+}
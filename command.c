@@ -1,4 +1,5 @@
 #include "shell.h"
+#include "queue.h"
 
 typedef int (*func_t)(char **argv);
 
@@ -6,6 +7,7 @@ typedef struct
 {
   const char *name;
   func_t func;
+  bool forked; /* run in a subprocess, as if it was an external command */
 } command_t;
 
 static int do_quit(char **argv)
@@ -51,11 +53,8 @@ static int do_fg(char **argv)
 {
   int j = argv[0] ? atoi(argv[0]) : -1;
 
-  sigset_t mask;
-  Sigprocmask(SIG_BLOCK, &sigchld_mask, &mask);
-  if (!resumejob(j, FG, &mask))
+  if (!resumejob(j, FG))
     msg("fg: job not found: %s\n", argv[0]);
-  Sigprocmask(SIG_SETMASK, &mask, NULL);
   return 0;
 }
 
@@ -68,11 +67,8 @@ static int do_bg(char **argv)
 {
   int j = argv[0] ? atoi(argv[0]) : -1;
 
-  sigset_t mask;
-  Sigprocmask(SIG_BLOCK, &sigchld_mask, &mask);
-  if (!resumejob(j, BG, &mask))
+  if (!resumejob(j, BG))
     msg("bg: job not found: %s\n", argv[0]);
-  Sigprocmask(SIG_SETMASK, &mask, NULL);
   return 0;
 }
 
@@ -90,15 +86,496 @@ static int do_kill(char **argv)
 
   int j = atoi(argv[0] + 1);
 
-  sigset_t mask;
-  Sigprocmask(SIG_BLOCK, &sigchld_mask, &mask);
   if (!killjob(j))
     msg("kill: job not found: %s\n", argv[0]);
-  Sigprocmask(SIG_SETMASK, &mask, NULL);
 
   return 0;
 }
 
+/*
+ * Executable lookup table. Commands are resolved against PATH in the shell
+ * process, so a child never has to probe directories with failing execve.
+ * The table is flushed when PATH changes or when any directory that precedes
+ * (or contains) a cached command gets modified.
+ */
+#define NCMDBUCKETS 64
+
+typedef struct cmdent
+{
+  LIST_ENTRY(cmdent) link;
+  char *name;    /* command name as typed by the user */
+  char *path;    /* path name passed to execve */
+  int dir;       /* index into pathdirs the command was found in */
+  unsigned hits; /* number of lookups satisfied from the table */
+} cmdent_t;
+
+typedef struct pathdir
+{
+  char *name;            /* directory listed in PATH */
+  struct timespec mtime; /* modification time when last checked */
+} pathdir_t;
+
+static LIST_HEAD(cmdlist, cmdent) cmdtab[NCMDBUCKETS];
+static char *pathvar = NULL;       /* PATH the table was built against */
+static pathdir_t *pathdirs = NULL; /* directories of pathvar */
+static int npathdirs = 0;
+
+static void flushcommands(void)
+{
+  for (int i = 0; i < NCMDBUCKETS; i++)
+  {
+    cmdent_t *ent;
+    while ((ent = LIST_FIRST(&cmdtab[i])))
+    {
+      LIST_REMOVE(ent, link);
+      free(ent->name);
+      free(ent->path);
+      free(ent);
+    }
+  }
+}
+
+/* Split PATH into directories. Empty component stands for current directory. */
+static void setpath(const char *path)
+{
+  flushcommands();
+  for (int i = 0; i < npathdirs; i++)
+    free(pathdirs[i].name);
+  free(pathvar);
+
+  pathvar = strdup(path);
+  npathdirs = 0;
+  for (const char *p = path; *p; p++)
+    if (*p == ':')
+      npathdirs++;
+  pathdirs = realloc(pathdirs, sizeof(pathdir_t) * ++npathdirs);
+
+  for (int i = 0; i < npathdirs; i++)
+  {
+    size_t len = strcspn(path, ":");
+    pathdirs[i].name = len ? strndup(path, len) : strdup(".");
+    pathdirs[i].mtime = (struct timespec){0, 0};
+    path += len + 1;
+  }
+}
+
+/* Check if directory has been modified since we last looked at it. */
+static bool dirchanged(pathdir_t *dir)
+{
+  struct stat sb;
+  if (stat(dir->name, &sb) < 0)
+    sb.st_mtim = (struct timespec){0, 0};
+  bool changed = sb.st_mtim.tv_sec != dir->mtime.tv_sec ||
+                 sb.st_mtim.tv_nsec != dir->mtime.tv_nsec;
+  dir->mtime = sb.st_mtim;
+  return changed;
+}
+
+static bool executable_p(const char *path)
+{
+  struct stat sb;
+  if (stat(path, &sb) < 0 || !S_ISREG(sb.st_mode))
+    return false;
+  return access(path, X_OK) == 0;
+}
+
+/* Walk PATH and remember where the command lives. Only commands found in
+ * absolute directories are cached, as others depend on working directory. */
+static const char *searchpath(const char *name, struct cmdlist *bucket)
+{
+  static char buf[PATH_MAX];
+
+  for (int i = 0; i < npathdirs; i++)
+  {
+    pathdir_t *dir = &pathdirs[i];
+    (void)dirchanged(dir);
+    if (snprintf(buf, sizeof(buf), "%s/%s", dir->name, name) >= sizeof(buf))
+      continue;
+    if (!executable_p(buf))
+      continue;
+    if (dir->name[0] != '/')
+      return buf;
+    cmdent_t *ent = malloc(sizeof(cmdent_t));
+    ent->name = strdup(name);
+    ent->path = strdup(buf);
+    ent->dir = i;
+    ent->hits = 0;
+    LIST_INSERT_HEAD(bucket, ent, link);
+    return ent->path;
+  }
+
+  return NULL;
+}
+
+/* Returns path name to be passed to execve or NULL if command was not found.
+ * Returned string stays valid until the next call. */
+const char *findcommand(const char *name)
+{
+  const char *path = getenv("PATH");
+
+  if (index(name, '/') || path == NULL)
+    return name;
+
+  if (pathvar == NULL || strcmp(pathvar, path))
+    setpath(path);
+
+  uint32_t hash = jenkins_hash(name, strlen(name), HASHINIT);
+  struct cmdlist *bucket = &cmdtab[hash % NCMDBUCKETS];
+
+  cmdent_t *ent;
+  LIST_FOREACH(ent, bucket, link)
+  {
+    if (strcmp(ent->name, name))
+      continue;
+    for (int i = 0; i <= ent->dir; i++)
+    {
+      if (dirchanged(&pathdirs[i]))
+      {
+        debug("hash: '%s' changed, flushing table\n", pathdirs[i].name);
+        flushcommands();
+        return searchpath(name, bucket);
+      }
+    }
+    ent->hits++;
+    return ent->path;
+  }
+
+  return searchpath(name, bucket);
+}
+
+/*
+ * Display or reset executable lookup table.
+ * 'hash' - list remembered commands
+ * 'hash -r' - forget all remembered commands
+ */
+static int do_hash(char **argv)
+{
+  if (argv[0] && !strcmp(argv[0], "-r"))
+  {
+    flushcommands();
+    return 0;
+  }
+
+  if (argv[0])
+  {
+    msg("hash: unknown option: %s\n", argv[0]);
+    return 1;
+  }
+
+  bool empty = true;
+  for (int i = 0; i < NCMDBUCKETS; i++)
+  {
+    cmdent_t *ent;
+    LIST_FOREACH(ent, &cmdtab[i], link)
+    {
+      if (empty)
+        dprintf(STDOUT_FILENO, "hits\tcommand\n");
+      dprintf(STDOUT_FILENO, "%4u\t%s\n", ent->hits, ent->path);
+      empty = false;
+    }
+  }
+  if (empty)
+    dprintf(STDOUT_FILENO, "hash: hash table empty\n");
+  return 0;
+}
+
+/* Parse pipe capacity: number of bytes with optional K or M suffix.
+ * Sizes that do not fit in an int are rejected before they get scaled. */
+static int parsesize(const char *str)
+{
+  char *end;
+  long unit = 1;
+
+  errno = 0;
+  long size = strtol(str, &end, 10);
+  if (end == str || errno == ERANGE)
+    return -1;
+
+  if (*end == 'K' || *end == 'k')
+    unit = 1024, end++;
+  else if (*end == 'M' || *end == 'm')
+    unit = 1024 * 1024, end++;
+
+  if (*end || size <= 0 || size > INT_MAX / unit)
+    return -1;
+  return size * unit;
+}
+
+/*
+ * Display or change capacity of pipes created for pipelines.
+ * 'pipesize' - show current settings
+ * 'pipesize size' - use pipes of given capacity, e.g. 256K or 1M
+ * 'pipesize max' - use largest pipes allowed by /proc/sys/fs/pipe-max-size
+ * 'pipesize default' - use kernel default pipe capacity
+ * 'pipesize -a' / 'pipesize -n' - enable / disable adaptive growth of pipes
+ */
+static int do_pipesize(char **argv)
+{
+  if (argv[0] == NULL)
+  {
+    if (pipe_size > 0)
+      dprintf(STDOUT_FILENO, "size %d", pipe_size);
+    else
+      dprintf(STDOUT_FILENO, "size default");
+    dprintf(STDOUT_FILENO, ", max %d, adaptive %s\n", pipe_max_size(),
+            pipe_adaptive ? "on" : "off");
+    return 0;
+  }
+
+  for (int size; *argv; argv++)
+  {
+    if (!strcmp(*argv, "-a"))
+      pipe_adaptive = true;
+    else if (!strcmp(*argv, "-n"))
+      pipe_adaptive = false;
+    else if (!strcmp(*argv, "max"))
+      pipe_size = pipe_max_size();
+    else if (!strcmp(*argv, "default"))
+      pipe_size = 0;
+    else if ((size = parsesize(*argv)) > 0)
+      pipe_size = size;
+    else
+    {
+      msg("pipesize: invalid argument: %s\n", *argv);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Display or reset cache of parsed command lines.
+ * 'linecache' - show number of cached lines, hits and misses
+ * 'linecache -r' - forget all cached lines and reset counters
+ */
+static int do_linecache(char **argv)
+{
+  if (argv[0] && !strcmp(argv[0], "-r"))
+  {
+    flushlines();
+    return 0;
+  }
+
+  if (argv[0])
+  {
+    msg("linecache: unknown option: %s\n", argv[0]);
+    return 1;
+  }
+
+  prlinestats(STDOUT_FILENO);
+  return 0;
+}
+
+/*
+ * Control removal of useless 'cat file |' stages from pipelines.
+ * 'uncat' - show whether it's enabled and how many processes it saved
+ * 'uncat -a' / 'uncat -n' - enable / disable rewriting pipelines
+ * 'uncat -r' - reset the counter of saved processes
+ */
+static int do_uncat(char **argv)
+{
+  if (argv[0] == NULL)
+  {
+    dprintf(STDOUT_FILENO, "uncat %s, %u processes saved\n",
+            uncat ? "on" : "off", uncat_saved);
+    return 0;
+  }
+
+  for (; *argv; argv++)
+  {
+    if (!strcmp(*argv, "-a"))
+      uncat = true;
+    else if (!strcmp(*argv, "-n"))
+      uncat = false;
+    else if (!strcmp(*argv, "-r"))
+      uncat_saved = 0;
+    else
+    {
+      msg("uncat: invalid argument: %s\n", *argv);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+#define TEE_BUFSIZE 65536
+
+/* Move n bytes from pipe to fd, or fewer if input ends. Data is spliced,
+ * unless fd does not support it, e.g. a terminal or a file opened for
+ * appending, in which case it's copied through buf. If writing fails, the
+ * rest is read and discarded anyway. Returns number of bytes moved or -1. */
+static ssize_t pump(int pipe, int fd, size_t n, char *buf)
+{
+  size_t left = n;
+  bool failed = false;
+
+  while (left > 0)
+  {
+    ssize_t m = -1;
+
+    if (!failed)
+      m = splice(pipe, NULL, fd, NULL, left, SPLICE_F_MOVE);
+    if (m < 0 && errno == EINTR)
+      continue;
+    if (m < 0 && (failed || errno == EINVAL))
+    {
+      if ((m = read(pipe, buf, min(left, (size_t)TEE_BUFSIZE))) < 0)
+        return -1;
+      if (!failed && m > 0 && rio_writen(fd, buf, m) < 0)
+        failed = true;
+    }
+    else if (m < 0)
+    {
+      failed = true;
+      continue;
+    }
+    if (m == 0)
+      break;
+    left -= m;
+  }
+
+  return failed ? -1 : (ssize_t)(n - left);
+}
+
+/* Copy pipe on standard input to outputs without touching the data. Each
+ * output but the last gets a chunk duplicated with tee(2) into a spare pipe,
+ * which is then spliced to it. The last output takes the chunk from input. */
+static int teepipe(int *fds, int nfds, char *buf)
+{
+  int spare[2];
+  int status = 0;
+
+  Pipe2(spare, O_CLOEXEC);
+  fcntl(spare[1], F_SETPIPE_SZ, fcntl(STDIN_FILENO, F_GETPIPE_SZ));
+
+  while (nfds > 0)
+  {
+    /* Length of the chunk is known once it has been duplicated. */
+    ssize_t n = INT_MAX;
+
+    for (int i = 0; i < nfds - 1; i++)
+    {
+      ssize_t m = tee(STDIN_FILENO, spare[1], n, 0);
+      if (m < 0 && errno == EINTR)
+      {
+        i--;
+        continue;
+      }
+      if (m <= 0)
+        goto done;
+      n = m;
+      if (pump(spare[0], fds[i], n, buf) < 0)
+      {
+        msg("tee: %s\n", strerror(errno));
+        fds[i] = -1;
+        status = 1;
+      }
+    }
+
+    ssize_t m = pump(STDIN_FILENO, fds[nfds - 1], n, buf);
+    if (m < 0)
+    {
+      msg("tee: %s\n", strerror(errno));
+      fds[nfds - 1] = -1;
+      status = 1;
+    }
+    else if (m < n)
+    {
+      break;
+    }
+
+    int j = 0;
+    for (int i = 0; i < nfds; i++)
+      if (fds[i] >= 0)
+        fds[j++] = fds[i];
+    nfds = j;
+  }
+
+done:
+  Close(spare[0]);
+  Close(spare[1]);
+  return status;
+}
+
+/* Copy standard input that is not a pipe to outputs through buf. */
+static int teecopy(int *fds, int nfds, char *buf)
+{
+  int status = 0;
+  ssize_t n;
+
+  while (nfds > 0 && (n = read(STDIN_FILENO, buf, TEE_BUFSIZE)) != 0)
+  {
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+    {
+      msg("tee: %s\n", strerror(errno));
+      return 1;
+    }
+    for (int i = 0; i < nfds; i++)
+    {
+      if (rio_writen(fds[i], buf, n) >= 0)
+        continue;
+      msg("tee: %s\n", strerror(errno));
+      fds[i--] = fds[--nfds];
+      status = 1;
+    }
+  }
+
+  return status;
+}
+
+/*
+ * Copy standard input to standard output and to files.
+ * 'tee file...' - truncate files first
+ * 'tee -a file...' - append to files
+ * Input that is a pipe is copied with tee(2) and splice(2) without passing
+ * through user space. Runs in a subprocess, e.g. as a stage of pipeline.
+ * Other options are left to the external tee command.
+ */
+static int do_tee(char **argv)
+{
+  int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+  int status = 0;
+  int nfds = 0;
+
+  if (argv[0] && !strcmp(argv[0], "-a"))
+  {
+    flags ^= O_TRUNC | O_APPEND;
+    argv++;
+  }
+
+  int nargs = 0;
+  for (; argv[nargs]; nargs++)
+    if (argv[nargs][0] == '-')
+      return -1;
+
+  int fds[1 + nargs];
+  fds[nfds++] = STDOUT_FILENO;
+  for (; *argv; argv++)
+  {
+    int fd = open(*argv, flags, DEFFILEMODE);
+    if (fd < 0)
+    {
+      msg("tee: %s: %s\n", *argv, strerror(errno));
+      status = 1;
+      continue;
+    }
+    fds[nfds++] = fd;
+  }
+
+  struct stat sb;
+  char *buf = Malloc(TEE_BUFSIZE);
+
+  if (fstat(STDIN_FILENO, &sb) == 0 && S_ISFIFO(sb.st_mode))
+    status |= teepipe(fds, nfds, buf);
+  else
+    status |= teecopy(fds, nfds, buf);
+
+  free(buf);
+  return status;
+}
+
 static command_t builtins[] = {
     {"quit", do_quit},
     {"cd", do_chdir},
@@ -106,9 +583,31 @@ static command_t builtins[] = {
     {"fg", do_fg},
     {"bg", do_bg},
     {"kill", do_kill},
+    {"hash", do_hash},
+    {"pipesize", do_pipesize},
+    {"linecache", do_linecache},
+    {"uncat", do_uncat},
+    {"tee", do_tee, true},
     {NULL, NULL},
 };
 
+bool builtin_p(const char *name)
+{
+  for (command_t *cmd = builtins; cmd->name; cmd++)
+    if (!strcmp(name, cmd->name))
+      return true;
+  return false;
+}
+
+/* Check whether a builtin is to be executed within shell's process. */
+bool shell_builtin_p(const char *name)
+{
+  for (command_t *cmd = builtins; cmd->name; cmd++)
+    if (!strcmp(name, cmd->name))
+      return !cmd->forked;
+  return false;
+}
+
 int builtin_command(char **argv)
 {
   for (command_t *cmd = builtins; cmd->name; cmd++)
@@ -122,31 +621,16 @@ int builtin_command(char **argv)
   return -1;
 }
 
-noreturn void external_command(char **argv)
+/* Executed in a subprocess. Path name must be resolved by findcommand
+ * beforehand, so that the lookup table is maintained by the shell. */
+noreturn void external_command(const char *path, char **argv)
 {
-  const char *path = getenv("PATH");
-
-  if (!index(argv[0], '/') && path)
-  {
-    /* TODO: For all paths in PATH construct an absolute path and execve it. */
-    size_t pathlen = strlen(path);
-    unsigned iter = 0;
-    while (iter < pathlen)
-    {
-      unsigned nextiter = strcspn(path + iter, ":");
-      char *complete_path = strndup(path + iter, nextiter);
-      strapp(&complete_path, "/");
-      strapp(&complete_path, argv[0]);
-      (void)execve(complete_path, argv, environ);
-      iter += nextiter + 1;
-      free(complete_path);
-    }
-  }
+  if (path)
+    (void)execve(path, argv, environ);
   else
-  {
-    (void)execve(argv[0], argv, environ);
-  }
+    errno = ENOENT;
 
+  /* Exit codes for commands not found and not executable follow POSIX. */
   msg("%s: %s\n", argv[0], strerror(errno));
-  exit(EXIT_FAILURE);
+  exit(errno == ENOENT ? 127 : 126);
 }
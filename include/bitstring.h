@@ -37,6 +37,10 @@
 #ifndef _BITSTRING_H_
 #define _BITSTRING_H_
 
+/* modified to operate on whole machine words, searches use ctz/clz builtins
+ * instead of testing one bit at a time, bit_ffs_at, bit_ffc_at and bit_fls
+ * added after FreeBSD
+ */
 /* modified for SV/AT and bitstring bugfix by M.R.Murphy, 11oct91
  * bitstr_size changed gratuitously, but shorter
  * bit_alloc   spelling error fixed
@@ -51,18 +55,21 @@
  * works."
  *  /s/ Perry E. Metzger, 2 Feb 98
  */
-typedef unsigned char bitstr_t;
+typedef unsigned long bitstr_t;
 
 /* internal macros */
-/* byte of the bitstring bit is in */
-#define _bit_byte(bit) (uint32_t)((bit) >> 3)
+/* number of bits in a word of the bitstring */
+#define _BITSTR_BITS (sizeof(bitstr_t) * 8)
+
+/* word of the bitstring bit is in */
+#define _bit_idx(bit) ((size_t)(bit) / _BITSTR_BITS)
 
-/* mask for the bit within its byte */
-#define _bit_mask(bit) (uint32_t)((1 << (uint32_t)((bit)&0x7)))
+/* mask for the bit within its word */
+#define _bit_mask(bit) (1UL << ((size_t)(bit) % _BITSTR_BITS))
 
 /* external macros */
-/* bytes in a bitstring of nbits bits */
-#define bitstr_size(nbits) (size_t)((uint32_t)((nbits) + 7) >> 3)
+/* words in a bitstring of nbits bits */
+#define bitstr_size(nbits) _bit_idx((nbits) + _BITSTR_BITS - 1)
 
 /* allocate a bitstring */
 #define bit_alloc(nbits) calloc(bitstr_size(nbits), sizeof(bitstr_t))
@@ -71,19 +78,13 @@ typedef unsigned char bitstr_t;
 #define bit_decl(name, nbits) ((name)[bitstr_size(nbits)])
 
 /* is bit N of bitstring name set? */
-#define bit_test(name, bit)                                                    \
-  /*LINTED bitwise on signed*/ ((name)[_bit_byte(bit)] & _bit_mask(bit))
+#define bit_test(name, bit) (((name)[_bit_idx(bit)] & _bit_mask(bit)) != 0)
 
 /* set bit N of bitstring name */
-#define bit_set(name, bit)                                                     \
-  /*LINTED bitwise on signed*/                                                 \
-  ((name)[_bit_byte(bit)] =                                                    \
-     (unsigned char)(_bit_mask(bit) | (name)[_bit_byte(bit)]))
+#define bit_set(name, bit) ((name)[_bit_idx(bit)] |= _bit_mask(bit))
 
 /* clear bit N of bitstring name */
-#define bit_clear(name, bit)                                                   \
-  /*LINTED bitwise on signed*/                                                 \
-  ((name)[_bit_byte(bit)] &= (unsigned char)~_bit_mask(bit))
+#define bit_clear(name, bit) ((name)[_bit_idx(bit)] &= ~_bit_mask(bit))
 
 /* clear bits start ... stop in bitstring */
 #define bit_nclear(name, start, stop)                                          \
@@ -107,32 +108,61 @@ typedef unsigned char bitstr_t;
     }                                                                          \
   } while (/*CONSTCOND*/ 0)
 
+/* Searches below examine a whole word at a time. Word is complemented
+ * (flip == ~0UL) when looking for a clear bit. */
+static inline int _bit_ff_at(const bitstr_t *name, int start, int nbits,
+                             bitstr_t flip) {
+  if (start < 0)
+    start = 0;
+  if (start >= nbits)
+    return -1;
+
+  size_t idx = _bit_idx(start), last = _bit_idx(nbits - 1);
+  bitstr_t word = (name[idx] ^ flip) & (~0UL << (start % _BITSTR_BITS));
+
+  while (word == 0) {
+    if (++idx > last)
+      return -1;
+    word = name[idx] ^ flip;
+  }
+
+  int bit = idx * _BITSTR_BITS + __builtin_ctzl(word);
+  return bit < nbits ? bit : -1;
+}
+
+static inline int _bit_fl_at(const bitstr_t *name, int nbits, bitstr_t flip) {
+  if (nbits <= 0)
+    return -1;
+
+  size_t idx = _bit_idx(nbits - 1);
+  size_t shift = _BITSTR_BITS - 1 - (nbits - 1) % _BITSTR_BITS;
+  bitstr_t word = (name[idx] ^ flip) & (~0UL >> shift);
+
+  while (word == 0) {
+    if (idx-- == 0)
+      return -1;
+    word = name[idx] ^ flip;
+  }
+
+  return idx * _BITSTR_BITS + (_BITSTR_BITS - 1 - __builtin_clzl(word));
+}
+
+/* find first bit clear in name at or after start */
+#define bit_ffc_at(name, start, nbits, value)                                  \
+  (*(value) = _bit_ff_at((name), (start), (nbits), ~0UL))
+
+/* find first bit set in name at or after start */
+#define bit_ffs_at(name, start, nbits, value)                                  \
+  (*(value) = _bit_ff_at((name), (start), (nbits), 0UL))
+
 /* find first bit clear in name */
-#define bit_ffc(name, nbits, value)                                            \
-  do {                                                                         \
-    const bitstr_t *_name = name;                                              \
-    size_t _bit, _nbits = nbits;                                               \
-    int _value = -1;                                                           \
-    for (_bit = 0; _bit < _nbits; ++_bit)                                      \
-      if (!bit_test(_name, _bit)) {                                            \
-        _value = _bit;                                                         \
-        break;                                                                 \
-      }                                                                        \
-    *(value) = _value;                                                         \
-  } while (/*CONSTCOND*/ 0)
+#define bit_ffc(name, nbits, value) bit_ffc_at((name), 0, (nbits), (value))
 
 /* find first bit set in name */
-#define bit_ffs(name, nbits, value)                                            \
-  do {                                                                         \
-    const bitstr_t *_name = name;                                              \
-    size_t _bit, _nbits = nbits;                                               \
-    int _value = -1;                                                           \
-    for (_bit = 0; _bit < _nbits; ++_bit)                                      \
-      if (bit_test(_name, _bit)) {                                             \
-        _value = _bit;                                                         \
-        break;                                                                 \
-      }                                                                        \
-    *(value) = _value;                                                         \
-  } while (/*CONSTCOND*/ 0)
+#define bit_ffs(name, nbits, value) bit_ffs_at((name), 0, (nbits), (value))
+
+/* find last bit set in name below nbits */
+#define bit_fls(name, nbits, value)                                            \
+  (*(value) = _bit_fl_at((name), (nbits), 0UL))
 
 #endif /* !_BITSTRING_H_ */
@@ -11,17 +11,35 @@ typedef struct {
   char rio_buf[RIO_BUFSIZE]; /* Internal buffer */
 } rio_t;
 
+/* Persistent state for buffered output */
+typedef struct {
+  int rio_fd;                /* Descriptor for this internal buf */
+  int rio_cnt;               /* Buffered bytes not yet written */
+  char rio_buf[RIO_BUFSIZE]; /* Internal buffer */
+} rio_wbuf_t;
+
 /* Rio (Robust I/O) package */
 ssize_t rio_readn(int fd, void *usrbuf, size_t n);
 ssize_t rio_writen(int fd, void *usrbuf, size_t n);
 void rio_readinitb(rio_t *rp, int fd);
 ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t rio_readline_view(rio_t *rp, char **linep);
+void rio_writeinitb(rio_wbuf_t *wp, int fd);
+ssize_t rio_writeb(rio_wbuf_t *wp, const void *usrbuf, size_t n);
+ssize_t rio_writevb(rio_wbuf_t *wp, const struct iovec *iov, int iovcnt);
+ssize_t rio_printfb(rio_wbuf_t *wp, const char *fmt, ...)
+  __attribute__((format(printf, 2, 3)));
+ssize_t rio_flushb(rio_wbuf_t *wp);
 
 /* Wrappers that exit on failure */
 ssize_t Rio_readn(int fd, void *ptr, size_t nbytes);
 void Rio_writen(int fd, void *usrbuf, size_t n);
 ssize_t Rio_readnb(rio_t *rp, void *usrbuf, size_t n);
 ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+ssize_t Rio_readline_view(rio_t *rp, char **linep);
+void Rio_writeb(rio_wbuf_t *wp, const void *usrbuf, size_t n);
+void Rio_writevb(rio_wbuf_t *wp, const struct iovec *iov, int iovcnt);
+void Rio_flushb(rio_wbuf_t *wp);
 
 #endif /* !_RIO_H_ */
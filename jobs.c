@@ -1,10 +1,19 @@
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+
 #include "shell.h"
+#include "bitstring.h"
 
 typedef struct proc
 {
-  pid_t pid;    /* process identifier */
-  int state;    /* RUNNING or STOPPED or FINISHED */
-  int exitcode; /* -1 if exit status not yet received */
+  pid_t pid;              /* process identifier */
+  int state;              /* RUNNING or STOPPED or FINISHED */
+  int exitcode;           /* -1 if exit status not yet received */
+  struct timeval finish;  /* time when process was reaped */
+  struct rusage rusage;   /* resources used, valid when FINISHED */
+  int pipefd;             /* read end of input pipe being watched or -1 */
+  int pipesz;             /* capacity of watched pipe */
 } proc_t;
 
 typedef struct job
@@ -13,65 +22,184 @@ typedef struct job
   proc_t *proc;          /* array of processes running in as a job */
   struct termios tmodes; /* saved terminal modes */
   int nproc;             /* number of processes */
+  int nprocmax;          /* number of slots in proc array */
+  int nrunning;          /* number of processes in RUNNING state */
+  int nstopped;          /* number of processes in STOPPED state */
   int state;             /* changes when live processes have same state */
+  int npipes;            /* number of pipes watched for adaptive sizing */
   char *command;         /* textual representation of command line */
+  size_t cmdlen;         /* length of command string */
+  struct timeval start;  /* time when job was created */
+  bool timed;            /* report resource usage when job finishes */
 } job_t;
 
+/* Entry of process index. Maps pid of a live process to its job and slot. */
+typedef struct pident
+{
+  pid_t pid; /* 0 if entry is free, -1 if it was deleted */
+  int job;   /* index into jobs array */
+  int proc;  /* index into proc array of the job */
+} pident_t;
+
+#define PID_FREE 0
+#define PID_DELETED -1
+
+/* Jobs array grows and shrinks by powers of two. Free slots keep their proc
+ * arrays, so that launching a job usually doesn't need to allocate memory. */
+#define NJOBMIN 8  /* minimum number of slots in jobs array */
+#define NPROCMAX 8 /* proc arrays larger than that are not kept for reuse */
+
+#define PIPE_SAMPLE_MS 50 /* how often to check fill level of watched pipes */
+
 static job_t *jobs = NULL;          /* array of all jobs */
-static int njobmax = 1;             /* number of slots in jobs array */
-static int tty_fd = -1;             /* controlling terminal file descriptor */
+static int njobmax = 1;             /* slots below that may be in use */
+static int njobcap = 0;             /* number of slots in jobs array */
+static bitstr_t *jobmask = NULL;    /* set bits mark slots that are in use */
 static struct termios shell_tmodes; /* saved shell terminal modes */
+static int sigchld_fd = -1;         /* signalfd reporting SIGCHLD */
+
+int tty_fd = -1; /* controlling terminal file descriptor */
+
+/* Open addressing hash table with linear probing. */
+static pident_t *pidtab = NULL; /* array of pidtab_size entries */
+static int pidtab_size = 0;     /* always a power of two */
+static int pidtab_used = 0;     /* number of entries that are not free */
+
+static unsigned pidhash(pid_t pid)
+{
+  return ((uint32_t)pid * 2654435761U) & (pidtab_size - 1);
+}
+
+static pident_t *pidfind(pid_t pid)
+{
+  if (pidtab_size == 0)
+    return NULL;
+  for (unsigned i = pidhash(pid);; i = (i + 1) & (pidtab_size - 1))
+  {
+    if (pidtab[i].pid == pid)
+      return &pidtab[i];
+    if (pidtab[i].pid == PID_FREE)
+      return NULL;
+  }
+}
+
+static void pidinsert(pid_t pid, int job, int proc);
+
+/* Rebuild the table twice as big as needed for live entries.
+ * This also gets rid of deleted entries. */
+static void pidrehash(void)
+{
+  pident_t *old = pidtab;
+  int oldsize = pidtab_size;
+  int live = 0;
+
+  for (int i = 0; i < oldsize; i++)
+    if (old[i].pid > 0)
+      live++;
+
+  for (pidtab_size = 64; pidtab_size < live * 4; pidtab_size *= 2)
+    continue;
+  pidtab = Calloc(pidtab_size, sizeof(pident_t));
+  pidtab_used = 0;
+
+  for (int i = 0; i < oldsize; i++)
+    if (old[i].pid > 0)
+      pidinsert(old[i].pid, old[i].job, old[i].proc);
+  free(old);
+}
 
-static void sigchld_handler(int sig)
+static void pidinsert(pid_t pid, int job, int proc)
 {
-  int old_errno = errno;
+  if ((pidtab_used + 1) * 2 > pidtab_size)
+    pidrehash();
+
+  unsigned i = pidhash(pid);
+  while (pidtab[i].pid > 0)
+    i = (i + 1) & (pidtab_size - 1);
+  if (pidtab[i].pid == PID_FREE)
+    pidtab_used++;
+  pidtab[i] = (pident_t){.pid = pid, .job = job, .proc = proc};
+}
+
+/* Move process to a new state and update job's state in constant time. */
+static void setprocstate(job_t *job, proc_t *proc, int state)
+{
+  if (proc->state == RUNNING)
+    job->nrunning--;
+  else if (proc->state == STOPPED)
+    job->nstopped--;
+
+  if (state == RUNNING)
+    job->nrunning++;
+  else if (state == STOPPED)
+    job->nstopped++;
+
+  proc->state = state;
+
+  if (job->nrunning > 0)
+    job->state = RUNNING;
+  else if (job->nstopped > 0)
+    job->state = STOPPED;
+  else
+    job->state = FINISHED;
+}
+
+/* Change state (FINISHED, RUNNING, STOPPED) of processes and jobs.
+ * Bury all children that finished saving their status in jobs. */
+static void reapjobs(void)
+{
+  struct signalfd_siginfo si;
   pid_t pid;
   int status;
-  /* TODO: Change state (FINISHED, RUNNING, STOPPED) of processes and jobs.
-   * Bury all children that finished saving their status in jobs. */
-  while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0)
+
+  /* Only fact that SIGCHLD is pending matters, as waitpid collects all. */
+  while (read(sigchld_fd, &si, sizeof(si)) > 0)
+    continue;
+
+  struct rusage rusage;
+  while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &rusage)) > 0)
   {
-    for (int i = 0; i < njobmax; i++)
-      for (int j = 0; j < jobs[i].nproc; j++)
-        if (jobs[i].proc[j].pid == pid)
-        {
-          if (WIFCONTINUED(status))
-            jobs[i].proc[j].state = RUNNING;
-          else if (WIFSTOPPED(status))
-            jobs[i].proc[j].state = STOPPED;
-          else //FINISHED
-          {
-            jobs[i].proc[j].state = FINISHED;
-            jobs[i].proc[j].exitcode = status;
-          }
-
-          bool is_running = false;
-          bool is_stopped = false;
-          for (int k = 0; k < jobs[i].nproc; k++)
-            if (jobs[i].proc[k].state == RUNNING)
-            {
-              jobs[i].state = RUNNING;
-              is_running = true;
-              break;
-            }
-
-          if (!is_running)
-            for (int k = 0; k < jobs[i].nproc; k++)
-              if (jobs[i].proc[k].state == STOPPED)
-              {
-                jobs[i].state = STOPPED;
-                is_stopped = true;
-                break;
-              }
-          if (!is_running && !is_stopped)
-            jobs[i].state = FINISHED;
-          //break outer for
-          i = njobmax;
-          break;
-        }
+    pident_t *ent = pidfind(pid);
+    if (ent == NULL)
+      continue;
+
+    job_t *job = &jobs[ent->job];
+    proc_t *proc = &job->proc[ent->proc];
+
+    if (WIFCONTINUED(status))
+      setprocstate(job, proc, RUNNING);
+    else if (WIFSTOPPED(status))
+      setprocstate(job, proc, STOPPED);
+    else //FINISHED
+    {
+      proc->exitcode = status;
+      proc->rusage = rusage;
+      gettime(&proc->finish);
+      if (proc->pipefd >= 0)
+        Close(proc->pipefd);
+      proc->pipefd = -1;
+      setprocstate(job, proc, FINISHED);
+      ent->pid = PID_DELETED;
+    }
   }
+}
+
+/* Event loop step. Sleep until a child changes its state, fd (if it's not
+ * negative) becomes readable or timeout (in milliseconds, -1 for infinity)
+ * expires. State changes get applied to jobs before return.
+ * Returns true if fd is ready to be read. */
+bool pollevents(int fd, int timeout)
+{
+  struct pollfd fds[2] = {
+    {.fd = sigchld_fd, .events = POLLIN},
+    {.fd = fd, .events = POLLIN},
+  };
 
-  errno = old_errno;
+  if (Poll(fds, fd < 0 ? 1 : 2, timeout) == 0)
+    return false;
+  if (fds[0].revents)
+    reapjobs();
+  return fd >= 0 && fds[1].revents;
 }
 
 /* When pipeline is done, its exitcode is fetched from the last process. */
@@ -80,70 +208,151 @@ static int exitcode(job_t *job)
   return job->proc[job->nproc - 1].exitcode;
 }
 
+static void resizejobs(int size)
+{
+  for (int j = size; j < njobcap; j++)
+    free(jobs[j].proc);
+  jobs = Realloc(jobs, sizeof(job_t) * size);
+  jobmask = Realloc(jobmask, sizeof(bitstr_t) * bitstr_size(size));
+  if (size > njobcap)
+  {
+    memset(&jobs[njobcap], 0, sizeof(job_t) * (size - njobcap));
+    for (int j = njobcap; j < size; j++)
+      bit_clear(jobmask, j);
+  }
+  njobcap = size;
+}
+
 static int allocjob(void)
 {
   /* Find empty slot for background job. */
-  for (int j = BG; j < njobmax; j++)
-    if (jobs[j].pgid == 0)
-      return j;
-
-  /* If none found, allocate new one. */
-  jobs = realloc(jobs, sizeof(job_t) * (njobmax + 1));
-  memset(&jobs[njobmax], 0, sizeof(job_t));
+  int j;
+  bit_ffc_at(jobmask, BG, njobmax, &j);
+  if (j >= 0)
+    return j;
+
+  /* If none found, take one past the last used slot. */
+  if (njobmax == njobcap)
+    resizejobs(njobcap * 2);
   return njobmax++;
 }
 
+/* Drop free slots from the end of jobs array. Release memory if most of
+ * the array is not used anymore. */
+static void trimjobs(void)
+{
+  int last;
+  bit_fls(jobmask, njobmax, &last);
+  njobmax = max(last + 1, BG);
+
+  int size = njobcap;
+  while (size > NJOBMIN && njobmax <= size / 4)
+    size /= 2;
+  if (size < njobcap)
+    resizejobs(size);
+}
+
 static int allocproc(int j)
 {
   job_t *job = &jobs[j];
-  job->proc = realloc(job->proc, sizeof(proc_t) * (job->nproc + 1));
+  if (job->nproc == job->nprocmax)
+  {
+    job->nprocmax = max(job->nprocmax * 2, 1);
+    job->proc = Realloc(job->proc, sizeof(proc_t) * job->nprocmax);
+  }
   return job->nproc++;
 }
 
-int addjob(pid_t pgid, int bg)
+/* Set up a job that is going to consist of nproc processes. */
+int addjob(pid_t pgid, int bg, int nproc)
 {
   int j = bg ? allocjob() : FG;
   job_t *job = &jobs[j];
+  bit_set(jobmask, j);
   /* Initial state of a job. */
   job->pgid = pgid;
   job->state = RUNNING;
   job->command = NULL;
-  job->proc = NULL;
+  job->cmdlen = 0;
   job->nproc = 0;
+  job->nrunning = 0;
+  job->nstopped = 0;
+  job->npipes = 0;
   job->tmodes = shell_tmodes;
+  job->timed = false;
+  gettime(&job->start);
+  if (nproc > job->nprocmax)
+  {
+    job->nprocmax = nproc;
+    job->proc = Realloc(job->proc, sizeof(proc_t) * nproc);
+  }
   return j;
 }
 
 static void deljob(job_t *job)
 {
   assert(job->state == FINISHED);
+  bit_clear(jobmask, job - jobs);
   free(job->command);
-  free(job->proc);
   job->pgid = 0;
   job->command = NULL;
-  job->proc = NULL;
+  job->cmdlen = 0;
   job->nproc = 0;
+  if (job->nprocmax > NPROCMAX)
+  {
+    free(job->proc);
+    job->proc = NULL;
+    job->nprocmax = 0;
+  }
+  if (job - jobs == njobmax - 1)
+    trimjobs();
 }
 
 static void movejob(int from, int to)
 {
   assert(jobs[to].pgid == 0);
+  free(jobs[to].proc);
   memcpy(&jobs[to], &jobs[from], sizeof(job_t));
   memset(&jobs[from], 0, sizeof(job_t));
+  bit_set(jobmask, to);
+  bit_clear(jobmask, from);
+
+  for (int i = 0; i < jobs[to].nproc; i++)
+  {
+    pident_t *ent = pidfind(jobs[to].proc[i].pid);
+    if (ent != NULL)
+      ent->job = to;
+  }
 }
 
-static void mkcommand(char **cmdp, char **argv)
+/* Append process arguments to textual representation of the job. Pipeline
+ * stages are separated with " | ". Length of the result is computed first,
+ * so the string is resized and filled in just once. */
+static void mkcommand(job_t *job, char **argv)
 {
-  if (*cmdp)
-    strapp(cmdp, " | ");
+  size_t len = job->cmdlen;
 
-  for (strapp(cmdp, *argv++); *argv; argv++)
+  if (len > 0)
+    len += strlen(" | ");
+  for (char **arg = argv; *arg; arg++)
+    len += strlen(*arg) + (arg != argv);
+
+  job->command = Realloc(job->command, len + 1);
+
+  char *p = job->command + job->cmdlen;
+  if (job->cmdlen > 0)
+    p = stpcpy(p, " | ");
+  for (char **arg = argv; *arg; arg++)
   {
-    strapp(cmdp, " ");
-    strapp(cmdp, *argv);
+    if (arg != argv)
+      *p++ = ' ';
+    p = stpcpy(p, *arg);
   }
+  job->cmdlen = len;
 }
 
+/* Add a process to the job. Its arguments are appended to job's command,
+ * unless argv is NULL, which is the case for helper processes. */
 void addproc(int j, pid_t pid, char **argv)
 {
   assert(j < njobmax);
@@ -155,7 +364,116 @@ void addproc(int j, pid_t pid, char **argv)
   proc->pid = pid;
   proc->state = RUNNING;
   proc->exitcode = -1;
-  mkcommand(&job->command, argv);
+  proc->pipefd = -1;
+  job->nrunning++;
+  pidinsert(pid, j, p);
+  if (argv != NULL)
+    mkcommand(job, argv);
+}
+
+/* Watch the pipe feeding the most recently added process of the job. While
+ * the job runs in foreground the pipe is grown whenever it's found nearly full,
+ * i.e. its writer is likely to be blocked. Descriptor is closed when the
+ * process finishes, so that writer gets EPIPE as usual. */
+void watchpipe(int j, int fd)
+{
+  if (fd < 0)
+    return;
+  assert(j < njobmax);
+  proc_t *proc = &jobs[j].proc[jobs[j].nproc - 1];
+  proc->pipefd = fd;
+  proc->pipesz = fcntl(fd, F_GETPIPE_SZ);
+  jobs[j].npipes++;
+}
+
+static void growpipes(job_t *job)
+{
+  for (int i = 0; i < job->nproc; i++)
+  {
+    proc_t *proc = &job->proc[i];
+    int queued;
+
+    if (proc->pipefd < 0 || proc->pipesz >= pipe_max_size())
+      continue;
+    if (ioctl(proc->pipefd, FIONREAD, &queued) < 0)
+      continue;
+    if (queued < proc->pipesz / 4 * 3)
+      continue;
+
+    int size = min(proc->pipesz * 2, pipe_max_size());
+    if ((size = fcntl(proc->pipefd, F_SETPIPE_SZ, size)) < 0)
+      continue;
+    debug("[%d] pipe of process %d grown to %d\n", (int)(job - jobs), proc->pid, size);
+    proc->pipesz = size;
+  }
+}
+
+/* Print single line of time report: wall clock, user and system CPU time,
+ * and maximum resident set size, unless it is negative, i.e. unknown.
+ * Column headers are printed if label is NULL. */
+void prtimes(rio_wbuf_t *wp, const char *label, const struct timeval *real,
+             const struct rusage *ru)
+{
+  if (label == NULL)
+  {
+    rio_printfb(wp, "%-6s %11s %11s %11s %10s\n", "", "real", "user", "sys",
+                "maxrss");
+    return;
+  }
+  rio_printfb(wp, "%-6s %6ld.%03lds %6ld.%03lds %6ld.%03lds", label,
+              (long)real->tv_sec, (long)real->tv_usec / 1000,
+              (long)ru->ru_utime.tv_sec, (long)ru->ru_utime.tv_usec / 1000,
+              (long)ru->ru_stime.tv_sec, (long)ru->ru_stime.tv_usec / 1000);
+  if (ru->ru_maxrss < 0)
+    rio_printfb(wp, " %10s\n", "-");
+  else
+    rio_printfb(wp, " %8ldkB\n", ru->ru_maxrss);
+}
+
+/* Report resources used by each stage of a finished job and in total. */
+static void reporttimes(rio_wbuf_t *wp, job_t *job)
+{
+  struct timeval real = {0, 0};
+  struct rusage total = {};
+
+  prtimes(wp, NULL, NULL, NULL);
+
+  for (int i = 0; i < job->nproc; i++)
+  {
+    proc_t *proc = &job->proc[i];
+    struct timeval preal;
+    timersub(&proc->finish, &job->start, &preal);
+
+    if (job->nproc > 1)
+    {
+      char label[16];
+      snprintf(label, sizeof(label), "#%d", i);
+      prtimes(wp, label, &preal, &proc->rusage);
+    }
+
+    if (timercmp(&preal, &real, >))
+      real = preal;
+    timeradd(&total.ru_utime, &proc->rusage.ru_utime, &total.ru_utime);
+    timeradd(&total.ru_stime, &proc->rusage.ru_stime, &total.ru_stime);
+    total.ru_maxrss = max(total.ru_maxrss, proc->rusage.ru_maxrss);
+  }
+
+  prtimes(wp, "total", &real, &total);
+}
+
+/* Monotonic clock reading used to measure wall clock time of jobs. */
+void gettime(struct timeval *tv)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  TIMESPEC_TO_TIMEVAL(tv, &ts);
+}
+
+/* Request resource usage report when the job finishes. */
+void timejob(int j)
+{
+  assert(j < njobmax);
+  jobs[j].timed = true;
 }
 
 /* Returns job's state.
@@ -170,6 +488,13 @@ int jobstate(int j, int *statusp)
   if (state == FINISHED)
   {
     *statusp = exitcode(job);
+    if (job->timed)
+    {
+      rio_wbuf_t wb;
+      rio_writeinitb(&wb, STDERR_FILENO);
+      reporttimes(&wb, job);
+      rio_flushb(&wb);
+    }
     deljob(job);
   }
   return state;
@@ -182,14 +507,44 @@ char *jobcmd(int j)
   return job->command;
 }
 
+/* Deliver a signal to all processes of a job. Without job control processes
+ * stay in shell's process group, so they have to be signalled one by one. */
+static void signaljob(job_t *job, int sig)
+{
+  if (interactive)
+  {
+    Kill(-job->pgid, sig);
+    return;
+  }
+  for (int i = 0; i < job->nproc; i++)
+    if (job->proc[i].state != FINISHED)
+      Kill(job->proc[i].pid, sig);
+}
+
+/* Send SIGCONT to a job and treat its processes as running right away.
+ * Pending notifications are collected first, so any stop reported later
+ * must have happened after the job was continued. */
+static void contjob(job_t *job)
+{
+  reapjobs();
+  signaljob(job, SIGCONT);
+  for (int i = 0; i < job->nproc; i++)
+    if (job->proc[i].state == STOPPED)
+      setprocstate(job, &job->proc[i], RUNNING);
+}
+
 /* Continues a job that has been stopped. If move to foreground was requested,
  * then move the job to foreground and start monitoring it. */
-bool resumejob(int j, int bg, sigset_t *mask)
+bool resumejob(int j, int bg)
 {
   if (j < 0)
   {
-    for (j = njobmax - 1; j > 0 && jobs[j].state == FINISHED; j--)
-      continue;
+    /* Pick most recent background job that has not finished. */
+    for (bit_fls(jobmask, njobmax, &j); j >= BG; bit_fls(jobmask, j, &j))
+      if (jobs[j].state != FINISHED)
+        break;
+    if (j < BG)
+      return false;
   }
 
   if (j >= njobmax || jobs[j].state == FINISHED)
@@ -200,14 +555,12 @@ bool resumejob(int j, int bg, sigset_t *mask)
   int sendmsg = 2; // 0 if all processes running, 1 if some but not all processes stopped, 2 if no processes running (job stopped)
   if (jobs[j].state == RUNNING)
     sendmsg = 0;
-  if (sendmsg == 0)
-    for (int i = 0; i < jobs[j].nproc; i++)
-      if (jobs[j].proc[i].state == STOPPED)
-        sendmsg = 1;
+  if (sendmsg == 0 && jobs[j].nstopped > 0)
+    sendmsg = 1;
   assert(jobs[j].pgid > 1);
-  Kill(-jobs[j].pgid, SIGCONT);
-  if (jobs[j].state == STOPPED)
-    Sigsuspend(mask);
+  if (bg == FG && interactive)
+    Tcsetpgrp(tty_fd, jobs[j].pgid);
+  contjob(&jobs[j]);
   if (sendmsg == 2)
     msg("[%d] continue '%s'\n", j, jobs[j].command);
   else if (sendmsg == 1)
@@ -215,8 +568,9 @@ bool resumejob(int j, int bg, sigset_t *mask)
   if (bg == FG)
   {
     movejob(j, FG);
-    Tcsetattr(tty_fd, TCSANOW, &jobs[FG].tmodes);
-    monitorjob(mask);
+    if (interactive)
+      Tcsetattr(tty_fd, TCSANOW, &jobs[FG].tmodes);
+    monitorjob();
   }
   return true;
 }
@@ -229,110 +583,156 @@ bool killjob(int j)
   debug("[%d] killing '%s'\n", j, jobs[j].command);
 
   /* TODO: I love the smell of napalm in the morning. */
-  for (int i = 0; i < jobs[j].nproc; i++)
-  {
-    Kill(jobs[j].proc[i].pid, SIGTERM);
-    Kill(jobs[j].proc[i].pid, SIGCONT); //na wypadek gdyby proces byl zatrzymany
-  }
+  signaljob(&jobs[j], SIGTERM);
+  signaljob(&jobs[j], SIGCONT); //na wypadek gdyby proces byl zatrzymany
   return true;
 }
 
-/* Report state of requested background jobs. Clean up finished jobs. */
+/* Write a line describing the job. Command may be long, so it's not formatted,
+ * but passed to the writer as a separate segment. */
+static void prjob(rio_wbuf_t *wp, int j, const char *what, const char *tail)
+{
+  char head[32];
+  int n = snprintf(head, sizeof(head), "[%d] %s'", j, what);
+  struct iovec iov[3] = {
+    {.iov_base = head, .iov_len = n},
+    {.iov_base = jobs[j].command, .iov_len = jobs[j].cmdlen},
+    {.iov_base = (char *)tail, .iov_len = strlen(tail)},
+  };
+  rio_writevb(wp, iov, 3);
+}
+
+/* Report state of requested background jobs. Clean up finished jobs.
+ * Listing of all jobs goes to standard output, notifications to stderr.
+ * Output is buffered, so that it takes a few writes for many jobs. */
 void watchjobs(int which)
 {
-  for (int j = BG; j < njobmax; j++)
-  {
-    if (jobs[j].pgid == 0)
-      continue;
+  rio_wbuf_t wb;
+  rio_writeinitb(&wb, (which == ALL) ? STDOUT_FILENO : STDERR_FILENO);
 
+  int j;
+  for (bit_ffs_at(jobmask, BG, njobmax, &j); j >= 0;
+       bit_ffs_at(jobmask, j + 1, njobmax, &j))
+  {
     /* TODO: Report job number, state, command and exit code or signal. */
     if (jobs[j].state != which && which != ALL)
       continue;
 
+    /* Non-interactive shell cleans up after background jobs silently. */
+    if (!interactive && which == FINISHED)
+    {
+      if (jobs[j].timed)
+        reporttimes(&wb, &jobs[j]);
+      deljob(&jobs[j]);
+      continue;
+    }
+
     if (jobs[j].state == RUNNING)
-      msg("[%d] running '%s'\n", j, jobs[j].command);
+      prjob(&wb, j, "running ", "'\n");
     else if (jobs[j].state == STOPPED)
-      msg("[%d] suspended '%s'\n", j, jobs[j].command);
+      prjob(&wb, j, "suspended ", "'\n");
     else //FINISHED
     {
       int wstatus = exitcode(&jobs[j]);
+      char tail[32];
 
-      msg("[%d] ", j);
       if (WIFEXITED(wstatus))
       {
-        msg("exited '%s', status=%d\n", jobs[j].command, WEXITSTATUS(wstatus));
+        snprintf(tail, sizeof(tail), "', status=%d\n", WEXITSTATUS(wstatus));
+        prjob(&wb, j, "exited ", tail);
       }
       else if (WIFSIGNALED(wstatus))
       {
-        msg("killed '%s' by signal %d\n", jobs[j].command, WTERMSIG(wstatus));
+        snprintf(tail, sizeof(tail), "' by signal %d\n", WTERMSIG(wstatus));
+        prjob(&wb, j, "killed ", tail);
       }
       else
-        msg("'%s' unidentified termination\n", jobs[j].command);
+        prjob(&wb, j, "", "' unidentified termination\n");
+      if (jobs[j].timed)
+        reporttimes(&wb, &jobs[j]);
       deljob(&jobs[j]);
     }
   }
+
+  rio_flushb(&wb);
 }
 
 /* Monitor job execution. If it gets stopped move it to background.
- * When a job has finished or has been stopped move shell to foreground. */
-int monitorjob(sigset_t *mask)
+ * When a job has finished or has been stopped move shell to foreground.
+ * Returns exit status of the job, or 128 plus number of the signal that
+ * killed or stopped it. */
+int monitorjob(void)
 {
   int exitcode, state;
 
   /* TODO: Following code requires use of Tcsetpgrp of tty_fd. */
-  Tcsetpgrp(tty_fd, jobs[FG].pgid);
-  /*Ponizej znajduje sie moje (troche brzydkie) rozwiazanie problemu dla przypadkow, w ktorych 
-  program po wybudzeniu zdazy sie(albo ktos inny go) uspic, gdzie inaczej moglibysmy sie zapetlic, uruchamiajac np.:
-  
-  #include <signal.h>
-
-  int main()
+  if (interactive)
+    Tcsetpgrp(tty_fd, jobs[FG].pgid);
+  while ((state = jobstate(FG, &exitcode)) == RUNNING)
   {
-    while(1)
-      raise(SIGSTOP);
-
-    return 0;
-  }
-  */
-  Kill(-jobs[FG].pgid, SIGCONT);
-  int tries = 0;
-  while (jobs[FG].state == STOPPED && tries++ <= 128) //128 to arbitralna liczba
-  {
-    Kill(-jobs[FG].pgid, SIGCONT);
-    Sigsuspend(mask);
-  }
-  while (true)
-  {
-    state = jobstate(FG, &exitcode);
-    if (state == RUNNING)
-      Sigsuspend(mask);
-    else
-      break;
+    if (jobs[FG].npipes == 0)
+    {
+      pollevents(-1, -1);
+      continue;
+    }
+    pollevents(-1, PIPE_SAMPLE_MS);
+    growpipes(&jobs[FG]);
   }
 
   if (state == STOPPED)
   {
-    int new_bg_job = addjob(0, BG);
+    int new_bg_job = addjob(0, BG, 0);
     movejob(FG, new_bg_job);
-    Tcgetattr(tty_fd, &jobs[new_bg_job].tmodes);
+    if (interactive)
+      Tcgetattr(tty_fd, &jobs[new_bg_job].tmodes);
     msg("[%d] suspended '%s'\n", new_bg_job, jobs[new_bg_job].command);
+    exitcode = W_STOPCODE(SIGTSTP);
   }
-  Tcsetpgrp(tty_fd, getpgrp());
-  Tcsetattr(tty_fd, TCSANOW, &shell_tmodes);
-  return exitcode;
+  if (interactive)
+  {
+    Tcsetpgrp(tty_fd, getpgrp());
+    Tcsetattr(tty_fd, TCSANOW, &shell_tmodes);
+  }
+
+  if (WIFEXITED(exitcode))
+    return WEXITSTATUS(exitcode);
+  if (WIFSIGNALED(exitcode))
+    return 128 + WTERMSIG(exitcode);
+  return 128 + WSTOPSIG(exitcode);
+}
+
+/* Move a descriptor of the shell out of range from 0 to 9, which belongs to
+ * redirections of commands, and make sure it's closed on execve. */
+int movefd(int fd)
+{
+  int newfd = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+  if (newfd < 0)
+    unix_error("Fcntl error");
+  Close(fd);
+  return newfd;
 }
 
 /* Called just at the beginning of shell's life. */
 void initjobs(void)
 {
-  Signal(SIGCHLD, sigchld_handler);
-  jobs = calloc(sizeof(job_t), 1);
-
-  /* Assume we're running in interactive mode, so move us to foreground.
-   * Duplicate terminal fd, but do not leak it to subprocesses that execve. */
+  /* SIGCHLD is never delivered asynchronously. Instead it's reported through
+   * a descriptor, which is polled in the event loop. Subprocesses must get
+   * the original signal mask back. */
+  Sigprocmask(SIG_BLOCK, &sigchld_mask, &child_mask);
+  sigchld_fd = signalfd(-1, &sigchld_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (sigchld_fd < 0)
+    unix_error("Signalfd error");
+  sigchld_fd = movefd(sigchld_fd);
+  resizejobs(NJOBMIN);
+
+  /* Shell that runs a script does not touch the terminal at all. */
+  if (!interactive)
+    return;
+
+  /* In interactive mode move us to foreground. Duplicate terminal fd,
+   * but do not leak it to subprocesses that execve. */
   assert(isatty(STDIN_FILENO));
-  tty_fd = Dup(STDIN_FILENO);
-  fcntl(tty_fd, F_SETFD, FD_CLOEXEC);
+  tty_fd = movefd(Dup(STDIN_FILENO));
 
   /* Take control of the terminal. */
   Tcsetpgrp(tty_fd, getpgrp());
@@ -341,37 +741,42 @@ void initjobs(void)
   Tcgetattr(tty_fd, &shell_tmodes);
 }
 
-/* Called just before the shell finishes. */
+/* Called just before the shell finishes. Interactive shell kills remaining
+ * jobs and waits for them, while a script or -c command leaves its background
+ * jobs running, as other shells do. */
 void shutdownjobs(void)
 {
-  sigset_t mask;
-  Sigprocmask(SIG_BLOCK, &sigchld_mask, &mask);
-
   /* TODO: Kill remaining jobs and wait for them to finish. */
 
-  for (int i = 0; i < njobmax; i++)
-    if (jobs[i].state != FINISHED)
-    {
-      Kill(-jobs[i].pgid, SIGTERM);
-      Kill(-jobs[i].pgid, SIGCONT);
-    }
-  while (true)
+  int j;
+  if (interactive)
   {
-    bool still_running = false; //nadal jest jakies niekonczone zadanie
-    for (int i = 0; i < njobmax; i++)
-      if (jobs[i].state != FINISHED)
+    for (bit_ffs(jobmask, njobmax, &j); j >= 0;
+         bit_ffs_at(jobmask, j + 1, njobmax, &j))
+      if (jobs[j].state != FINISHED)
       {
-        still_running = true;
-        break;
+        signaljob(&jobs[j], SIGTERM);
+        signaljob(&jobs[j], SIGCONT);
       }
-    if (still_running == true)
-      Sigsuspend(&mask);
-    else
-      break;
+    while (true)
+    {
+      bool still_running = false; //nadal jest jakies niekonczone zadanie
+      for (bit_ffs(jobmask, njobmax, &j); j >= 0;
+           bit_ffs_at(jobmask, j + 1, njobmax, &j))
+        if (jobs[j].state != FINISHED)
+        {
+          still_running = true;
+          break;
+        }
+      if (still_running == true)
+        pollevents(-1, -1);
+      else
+        break;
+    }
   }
   watchjobs(FINISHED);
 
-  Sigprocmask(SIG_SETMASK, &mask, NULL);
-
-  Close(tty_fd);
+  if (tty_fd >= 0)
+    Close(tty_fd);
+  Close(sigchld_fd);
 }
@@ -1,76 +1,287 @@
 #include "shell.h"
 
-void strapp(char **dstp, const char *src) {
-  assert(dstp != NULL);
-
-  if (*dstp == NULL) {
-    *dstp = strdup(src);
-  } else {
-    size_t s = strlen(*dstp) + strlen(src) + 1;
-    *dstp = realloc(*dstp, s);
-    strcat(*dstp, src);
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/* Byte classes recognized by the tokenizer. Locale is not taken into account,
+ * only ASCII whitespace separates words. */
+#define C_SPACE 1 /* whitespace */
+#define C_OPER 2  /* first character of an operator */
+#define C_END 4   /* end of string */
+
+static const uint8_t charclass[256] = {
+  ['\0'] = C_END,  [' '] = C_SPACE,  ['\t'] = C_SPACE, ['\n'] = C_SPACE,
+  ['\v'] = C_SPACE, ['\f'] = C_SPACE, ['\r'] = C_SPACE, ['|'] = C_OPER,
+  ['&'] = C_OPER,  ['<'] = C_OPER,   ['>'] = C_OPER,   [';'] = C_OPER,
+  ['!'] = C_OPER,
+};
+
+/* Same bytes as isspace() in the C locale, which wordend() matches too. */
+#define isspace_p(c) (charclass[(uint8_t)(c)] & C_SPACE)
+
+/*
+ * Length of word starting at s, i.e. distance to the first whitespace,
+ * operator or NUL character, but not further than end. Vectorized versions
+ * classify 16 or 32 bytes at once. Loads are aligned so they never cross
+ * a page boundary, and a block is loaded only if it begins before end, hence
+ * reading past the end of the word is harmless.
+ */
+#if defined(__SSE2__)
+typedef __m128i vec_t;
+typedef uint32_t vmask_t;
+#define VSIZE 16
+#define vload(p) _mm_load_si128((const vec_t *)(p))
+#define vbyte(c) _mm_set1_epi8(c)
+#define veq(a, b) _mm_cmpeq_epi8((a), (b))
+#define vor(a, b) _mm_or_si128((a), (b))
+#define vsub(a, b) _mm_sub_epi8((a), (b))
+#define vmin(a, b) _mm_min_epu8((a), (b))
+#define vmask(a) ((vmask_t)_mm_movemask_epi8(a))
+
+/* Bit mask of bytes that terminate a word. Forced inline, since at -Og the
+ * call and reloaded constants would cost as much as the comparisons. */
+static inline __attribute__((always_inline)) vmask_t wordend(vec_t v) {
+  vec_t m = veq(v, vbyte(0));
+  m = vor(m, veq(v, vbyte(' ')));
+  m = vor(m, veq(v, vbyte('|')));
+  m = vor(m, veq(v, vbyte('&')));
+  m = vor(m, veq(v, vbyte('<')));
+  m = vor(m, veq(v, vbyte('>')));
+  m = vor(m, veq(v, vbyte(';')));
+  m = vor(m, veq(v, vbyte('!')));
+  /* '\t', '\n', '\v', '\f' and '\r' occupy range from 9 to 13 */
+  vec_t t = vsub(v, vbyte('\t'));
+  m = vor(m, veq(vmin(t, vbyte('\r' - '\t')), t));
+  return vmask(m);
+}
+
+static size_t wordlen_sse2(const char *s, const char *end) {
+  size_t skew = (uintptr_t)s & (VSIZE - 1);
+  const char *p = s - skew;
+  vmask_t mask = wordend(vload(p)) >> skew;
+
+  if (mask)
+    return min((size_t)__builtin_ctz(mask), (size_t)(end - s));
+
+  for (p += VSIZE; p < end; p += VSIZE)
+    if ((mask = wordend(vload(p))))
+      return min(p - s + __builtin_ctz(mask), end - s);
+
+  return end - s;
+}
+
+/* AVX2 version looks bytes up by their low and high nibble. Each of the
+ * two tables has a bit per high nibble (0, 2, 3 and 7) in which word ending
+ * bytes occur, so a byte ends a word iff both lookups share a bit. Two blocks
+ * are tested per iteration, as long words are what makes scanning slow. */
+#define AVX2 __attribute__((target("avx2"), always_inline)) inline
+
+static AVX2 __m256i wordend_avx2(__m256i v) {
+  const __m256i lo = _mm256_setr_epi8(
+    3, 2, 0, 0, 0, 0, 2, 0, 0, 1, 1, 5, 13, 1, 4, 0,
+    3, 2, 0, 0, 0, 0, 2, 0, 0, 1, 1, 5, 13, 1, 4, 0);
+  const __m256i hi = _mm256_setr_epi8(
+    1, 0, 2, 4, 0, 0, 0, 8, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 0, 2, 4, 0, 0, 0, 8, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+
+  __m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(v, nibble));
+  __m256i h = _mm256_shuffle_epi8(
+    hi, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+  return _mm256_and_si256(l, h);
+}
+
+static AVX2 uint32_t wordmask_avx2(__m256i m) {
+  return ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(m, _mm256_setzero_si256()));
+}
+
+__attribute__((target("avx2"))) static size_t wordlen_avx2(const char *s,
+                                                          const char *end) {
+  size_t skew = (uintptr_t)s & 31;
+  const char *p = s - skew;
+  uint32_t mask;
+
+  mask = wordmask_avx2(wordend_avx2(_mm256_load_si256((__m256i *)p))) >> skew;
+  if (mask)
+    return min((size_t)__builtin_ctz(mask), (size_t)(end - s));
+
+  for (p += 32; p + 32 < end; p += 64) {
+    __m256i a = wordend_avx2(_mm256_load_si256((__m256i *)p));
+    __m256i b = wordend_avx2(_mm256_load_si256((__m256i *)(p + 32)));
+    __m256i ab = _mm256_or_si256(a, b);
+    if (_mm256_testz_si256(ab, ab))
+      continue;
+    if ((mask = wordmask_avx2(a)))
+      return min(p - s + __builtin_ctz(mask), end - s);
+    mask = wordmask_avx2(b);
+    return min(p + 32 - s + __builtin_ctz(mask), end - s);
   }
+
+  if (p < end &&
+      (mask = wordmask_avx2(wordend_avx2(_mm256_load_si256((__m256i *)p)))))
+    return min(p - s + __builtin_ctz(mask), end - s);
+
+  return end - s;
+}
+
+static size_t wordlen(const char *s, const char *end) {
+  if (__builtin_cpu_supports("avx2"))
+    return wordlen_avx2(s, end);
+  return wordlen_sse2(s, end);
+}
+#else
+static size_t wordlen(const char *s, const char *end) {
+  const char *p = s;
+  while (p < end && !charclass[(uint8_t)*p])
+    p++;
+  return p - s;
 }
+#endif
+
+/* Length of redirection operator starting at s, i.e. '<', '<&', '<<', '<<<',
+ * '>', '>&' or '>>'. Sets kind of the operator. */
+static size_t redirlen(const char *s, const char *end, uint8_t *kindp) {
+  size_t l = 1;
 
-token_t *tokenize(char *s, int *tokc_p) {
+  if (s[0] == '<' && s + 1 < end && s[1] == '<') {
+    *kindp = T_INPUT;
+    return (s + 2 < end && s[2] == '<') ? 3 : 2;
+  }
+
+  if (s[0] == '>' && s + 1 < end && s[1] == '>') {
+    *kindp = T_APPEND;
+    return 2;
+  }
+  *kindp = s[0] == '<' ? T_INPUT : T_OUTPUT;
+  if (s + 1 < end && s[1] == '&')
+    l++;
+  return l;
+}
+
+/* Length of process substitution starting at s, which extends up to the
+ * parenthesis matching the opening one, or to the end if there is none. */
+static size_t procsublen(const char *s, const char *end) {
+  const char *p = s + 2;
+
+  for (int depth = 1; p < end && *p != '\0'; p++) {
+    if (*p == '(')
+      depth++;
+    else if (*p == ')' && --depth == 0)
+      return p + 1 - s;
+  }
+  return p - s;
+}
+
+/* Split len characters of line into tokens. Line need not be terminated with
+ * NUL, so it can be a view into a larger buffer. */
+token_t *tokenize(arena_t *a, const char *line, size_t len, int *tokc_p) {
   int capacity = 10;
   int ntoks = 0;
+  const char *s = line;
+  const char *end = line + len;
 
-  token_t *tokvec = malloc(sizeof(token_t) * (capacity + 1));
+  token_t *tokvec = arena_alloc(a, sizeof(token_t) * (capacity + 1));
 
-  while (*s != 0) {
+  while (s < end && *s != 0) {
     /* Consume whitespace characters. */
-    if (isspace(*s)) {
-      *s++ = 0;
+    if (isspace_p(*s)) {
+      s++;
       continue;
     }
 
+    /* Comment extends to the end of line. */
+    if (*s == '#')
+      break;
+
     /* Make sure there's enough space to add new token. */
     if (ntoks == capacity) {
+      tokvec = arena_realloc(a, tokvec, sizeof(token_t) * (capacity + 1),
+                             sizeof(token_t) * (capacity * 2 + 1));
       capacity *= 2;
-      tokvec = realloc(tokvec, sizeof(token_t) * (capacity + 1));
-    }
-
-    size_t l = strcspn(s, " |&<>;!");
-    if (l > 0) {
-      tokvec[ntoks++] = s;
-      s += l;
-      continue;
     }
 
-    token_t tok;
+    token_t *tok = &tokvec[ntoks++];
+    size_t l = wordlen(s, end);
 
-    if (s[0] == '|') {
-      if (s[1] == '|') {
-        *s++ = 0;
-        tok = T_OR;
+    if (l > 0) {
+      tok->kind = T_WORD;
+    } else if (s[0] == '|') {
+      if (s + 1 < end && s[1] == '|') {
+        tok->kind = T_OR;
+        l++;
       } else {
-        tok = T_PIPE;
+        tok->kind = T_PIPE;
       }
     } else if (s[0] == '&') {
-      if (s[1] == '&') {
-        *s++ = 0;
-        tok = T_AND;
+      if (s + 1 < end && s[1] == '&') {
+        tok->kind = T_AND;
+        l++;
+      } else if (s + 1 < end && s[1] == '>') {
+        l = redirlen(s + 1, end, &tok->kind);
       } else {
-        tok = T_BGJOB;
+        tok->kind = T_BGJOB;
+      }
+    } else if ((s[0] == '<' || s[0] == '>') && s + 1 < end && s[1] == '(') {
+      tok->kind = T_WORD;
+      l = procsublen(s, end);
+    } else if (s[0] == '<' || s[0] == '>') {
+      l = redirlen(s, end, &tok->kind) - 1;
+      /* Single digit just before the operator is descriptor to redirect. */
+      if (ntoks > 1 && tok[-1].kind == T_WORD && tok[-1].length == 1 &&
+          tok[-1].offset + 1 == (uint32_t)(s - line) && s[-1] >= '0' &&
+          s[-1] <= '9') {
+        tok[-1].kind = tok->kind;
+        ntoks--;
+        tok--;
+        s--;
+        l++;
       }
-    } else if (s[0] == '<') {
-      tok = T_INPUT;
-    } else if (s[0] == '>') {
-      tok = T_OUTPUT;
     } else if (s[0] == ';') {
-      tok = T_COLON;
-    } else if (s[0] == '!') {
-      tok = T_BANG;
+      tok->kind = T_COLON;
     } else {
-      continue;
+      assert(s[0] == '!');
+      tok->kind = T_BANG;
     }
 
-    *s++ = 0;
-    tokvec[ntoks++] = tok;
+    if (tok->kind != T_WORD)
+      l++;
+
+    tok->offset = s - line;
+    tok->length = l;
+    s += l;
   }
 
-  tokvec[ntoks] = NULL;
+  tokvec[ntoks] = (token_t){.offset = s - line, .kind = T_NULL};
   *tokc_p = ntoks;
   return tokvec;
 }
+
+/* Check whether a word token spells given string. */
+bool tokeq(const char *line, const token_t *tok, const char *str) {
+  return tok->kind == T_WORD && strlen(str) == tok->length &&
+         !memcmp(line + tok->offset, str, tok->length);
+}
+
+/* Make NULL-terminated argument vector out of word tokens. Pointers and
+ * strings share a single allocation from the arena. */
+char **mkargv(arena_t *a, const char *line, const token_t *token,
+              int ntokens) {
+  size_t size = sizeof(char *) * (ntokens + 1);
+  for (int i = 0; i < ntokens; i++)
+    size += token[i].length + 1;
+
+  char **argv = arena_alloc(a, size);
+  char *str = (char *)&argv[ntokens + 1];
+
+  for (int i = 0; i < ntokens; i++) {
+    assert(token[i].kind == T_WORD && "shell operator in argv of a command");
+    argv[i] = str;
+    memcpy(str, line + token[i].offset, token[i].length);
+    str += token[i].length;
+    *str++ = '\0';
+  }
+
+  argv[ntokens] = NULL;
+  return argv;
+}
@@ -0,0 +1,8 @@
+#include "csapp.h"
+
+int Memfd_create(const char *name, unsigned flags) {
+  int fd = memfd_create(name, flags);
+  if (fd < 0)
+    unix_error("Memfd_create error");
+  return fd;
+}
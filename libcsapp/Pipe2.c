@@ -0,0 +1,6 @@
+#include "csapp.h"
+
+void Pipe2(int fds[2], int flags) {
+  if (pipe2(fds, flags) < 0)
+    unix_error("Pipe2 error");
+}
@@ -32,6 +32,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdnoreturn.h>
 #include <string.h>
 #include <termios.h>
@@ -62,6 +63,10 @@ extern char **environ;
 #define MAXLINE 4096
 
 /* Our own error-handling functions */
+#ifdef _GNU_SOURCE
+/* netdb.h declares gai_error for asynchronous name lookups, so avoid clash */
+#define gai_error csapp_gai_error
+#endif
 noreturn void unix_error(const char *fmt, ...)
   __attribute__((format(printf, 1, 2)));
 noreturn void posix_error(int code, const char *fmt, ...)
@@ -85,6 +90,25 @@ void *Malloc(size_t size);
 void *Realloc(void *ptr, size_t size);
 void *Calloc(size_t nmemb, size_t size);
 
+/* Arena allocator for objects that are released all at once */
+typedef struct arena_chunk arena_chunk_t;
+
+typedef struct arena {
+  arena_chunk_t *chunk; /* current chunk, older ones are linked behind */
+  char *ptr;            /* first free byte in current chunk */
+  char *end;            /* end of current chunk */
+  void *last;           /* most recent allocation, can be resized in place */
+  size_t nbytes;        /* bytes handed out since last reset */
+  size_t nallocs;       /* allocations served since last reset */
+  size_t nmallocs;      /* chunks requested from the heap since last reset */
+} arena_t;
+
+void *arena_alloc(arena_t *a, size_t size);
+void *arena_realloc(arena_t *a, void *ptr, size_t oldsize, size_t size);
+char *arena_strndup(arena_t *a, const char *s, size_t n);
+void arena_reset(arena_t *a);
+void arena_destroy(arena_t *a);
+
 /* Process control wrappers */
 pid_t Fork(void);
 pid_t Waitpid(pid_t pid, int *iptr, int options);
@@ -120,6 +144,7 @@ void Ftruncate(int fd, off_t length);
 int Dup(int fd);
 int Dup2(int oldfd, int newfd);
 void Pipe(int fds[2]);
+void Pipe2(int fds[2], int flags);
 void Socketpair(int domain, int type, int protocol, int sv[2]);
 int Select(int n, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
            struct timeval *timeout);
@@ -151,6 +176,7 @@ void *Mmap(void *addr, size_t length, int prot, int flags, int fd,
 void Mprotect(void *addr, size_t len, int prot);
 void Munmap(void *addr, size_t len);
 void Madvise(void *addr, size_t length, int advice);
+int Memfd_create(const char *name, unsigned flags);
 
 /* Terminal control */
 void Tcsetpgrp(int fd, pid_t pgrp);
@@ -20,3 +20,93 @@ void *Calloc(size_t nmemb, size_t size) {
     unix_error("Calloc error");
   return p;
 }
+
+#define ARENA_ALIGN _Alignof(max_align_t)
+#define ARENA_CHUNK 4096
+
+struct arena_chunk {
+  arena_chunk_t *next; /* previously used chunk */
+  size_t size;         /* number of usable bytes in data */
+  max_align_t data[];
+};
+
+static void arena_grow(arena_t *a, size_t size) {
+  size_t prev = a->chunk ? a->chunk->size : 0;
+  size = max(size, max((size_t)ARENA_CHUNK, prev * 2));
+
+  arena_chunk_t *chunk = Malloc(sizeof(arena_chunk_t) + size);
+  chunk->next = a->chunk;
+  chunk->size = size;
+  a->chunk = chunk;
+  a->ptr = (char *)chunk->data;
+  a->end = a->ptr + size;
+  a->nmallocs++;
+}
+
+void *arena_alloc(arena_t *a, size_t size) {
+  size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  if (size > (size_t)(a->end - a->ptr))
+    arena_grow(a, size);
+
+  void *p = a->ptr;
+  a->ptr += size;
+  a->last = p;
+  a->nbytes += size;
+  a->nallocs++;
+  return p;
+}
+
+/* Most recent allocation is extended in place if there's room for it. */
+void *arena_realloc(arena_t *a, void *ptr, size_t oldsize, size_t size) {
+  if (ptr != NULL && ptr == a->last) {
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    oldsize = (char *)a->ptr - (char *)ptr;
+    if (size <= (size_t)(a->end - (char *)ptr)) {
+      a->ptr = (char *)ptr + size;
+      a->nbytes += size - min(size, oldsize);
+      return ptr;
+    }
+  }
+
+  void *p = arena_alloc(a, size);
+  if (ptr != NULL)
+    memcpy(p, ptr, min(oldsize, size));
+  return p;
+}
+
+char *arena_strndup(arena_t *a, const char *s, size_t n) {
+  char *p = arena_alloc(a, n + 1);
+  memcpy(p, s, n);
+  p[n] = '\0';
+  return p;
+}
+
+/* Release all allocations but keep the most recent, i.e. the largest, chunk.
+ * Subsequent use of similar size is then served without touching the heap. */
+void arena_reset(arena_t *a) {
+  arena_chunk_t *chunk = a->chunk;
+
+  if (chunk == NULL)
+    return;
+
+  while (chunk->next) {
+    arena_chunk_t *next = chunk->next->next;
+    free(chunk->next);
+    chunk->next = next;
+  }
+
+  a->ptr = (char *)chunk->data;
+  a->last = NULL;
+  a->nbytes = 0;
+  a->nallocs = 0;
+  a->nmallocs = 0;
+}
+
+void arena_destroy(arena_t *a) {
+  while (a->chunk) {
+    arena_chunk_t *next = a->chunk->next;
+    free(a->chunk);
+    a->chunk = next;
+  }
+  *a = (arena_t){};
+}
@@ -1,3 +1,4 @@
+#include <stdarg.h>
 #include "csapp.h"
 #include "rio.h"
 
@@ -52,6 +53,22 @@ void Rio_writen(int fd, void *usrbuf, size_t n) {
     unix_error("Rio_writen error");
 }
 
+/* rio_fill - Refill internal buffer if it's empty. Returns number of unread
+ *    bytes in the buffer, 0 on EOF or -1 on error. */
+static ssize_t rio_fill(rio_t *rp) {
+  while (rp->rio_cnt <= 0) { /* Refill if buf is empty */
+    rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, sizeof(rp->rio_buf));
+    if (rp->rio_cnt < 0) {
+      if (errno != EINTR) /* Interrupted by sig handler return */
+        return -1;
+    } else if (rp->rio_cnt == 0) /* EOF */
+      return 0;
+    else
+      rp->rio_bufptr = rp->rio_buf; /* Reset buffer ptr */
+  }
+  return rp->rio_cnt;
+}
+
 /*
  * rio_read - This is a wrapper for the Unix read() function that
  *    transfers min(n, rio_cnt) bytes from an internal buffer to a user
@@ -63,21 +80,12 @@ void Rio_writen(int fd, void *usrbuf, size_t n) {
 static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n) {
   int cnt;
 
-  while (rp->rio_cnt <= 0) { /* Refill if buf is empty */
-    rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, sizeof(rp->rio_buf));
-    if (rp->rio_cnt < 0) {
-      if (errno != EINTR) /* Interrupted by sig handler return */
-        return -1;
-    } else if (rp->rio_cnt == 0) /* EOF */
-      return 0;
-    else
-      rp->rio_bufptr = rp->rio_buf; /* Reset buffer ptr */
-  }
+  if ((cnt = rio_fill(rp)) <= 0)
+    return cnt;
 
   /* Copy min(n, rp->rio_cnt) bytes from internal buf to user buf */
-  cnt = n;
-  if (rp->rio_cnt < n)
-    cnt = rp->rio_cnt;
+  if (cnt > n)
+    cnt = n;
   memcpy(usrbuf, rp->rio_bufptr, cnt);
   rp->rio_bufptr += cnt;
   rp->rio_cnt -= cnt;
@@ -115,28 +123,37 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n) {
   return (n - nleft); /* return >= 0 */
 }
 
-/* rio_readlineb - Robustly read a text line (buffered) */
+/* rio_readlineb - Robustly read a text line (buffered). Internal buffer is
+ *    searched for a newline with memchr and copied over in whole spans. */
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) {
-  int n, rc;
-  char c, *bufp = usrbuf;
-
-  for (n = 1; n < maxlen; n++) {
-    if ((rc = rio_read(rp, &c, 1)) == 1) {
-      *bufp++ = c;
-      if (c == '\n') {
-        n++;
-        break;
-      }
-    } else if (rc == 0) {
-      if (n == 1)
-        return 0; /* EOF, no data read */
-      else
-        break; /* EOF, some data was read */
-    } else
+  char *bufp = usrbuf;
+  size_t n = 0;
+
+  if (maxlen == 0)
+    return 0;
+
+  while (n < maxlen - 1) {
+    ssize_t cnt = rio_fill(rp);
+    if (cnt < 0)
       return -1; /* Error */
+    if (cnt == 0)
+      break; /* EOF */
+
+    size_t len = min((size_t)cnt, maxlen - 1 - n);
+    char *nl = memchr(rp->rio_bufptr, '\n', len);
+    if (nl)
+      len = nl - rp->rio_bufptr + 1;
+
+    memcpy(bufp + n, rp->rio_bufptr, len);
+    rp->rio_bufptr += len;
+    rp->rio_cnt -= len;
+    n += len;
+
+    if (nl)
+      break;
   }
-  *bufp = 0;
-  return n - 1;
+  bufp[n] = 0;
+  return n;
 }
 
 ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) {
@@ -145,3 +162,182 @@ ssize_t Rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) {
     unix_error("Rio_readlineb error");
   return rc;
 }
+
+/*
+ * rio_readline_view - Find next text line in internal buffer and return it
+ *    through linep without copying. Returns length of the line including
+ *    the newline, 0 on EOF or -1 on error. Line is not terminated with NUL
+ *    and remains valid until next call on rp. Partial line is moved to the
+ *    front of the buffer to be completed by subsequent read. A line that
+ *    does not fit in the buffer is returned in RIO_BUFSIZE pieces.
+ */
+ssize_t rio_readline_view(rio_t *rp, char **linep) {
+  size_t scanned = 0, n;
+
+  if (rp->rio_cnt <= 0) {
+    rp->rio_cnt = 0;
+    rp->rio_bufptr = rp->rio_buf;
+  }
+
+  while (true) {
+    char *nl = memchr(rp->rio_bufptr + scanned, '\n', rp->rio_cnt - scanned);
+    if (nl) {
+      n = nl - rp->rio_bufptr + 1;
+      break;
+    }
+    if ((n = scanned = rp->rio_cnt) == RIO_BUFSIZE)
+      break; /* Line longer than buffer */
+
+    if (rp->rio_bufptr != rp->rio_buf) {
+      memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+      rp->rio_bufptr = rp->rio_buf;
+    }
+
+    ssize_t nread = read(rp->rio_fd, rp->rio_buf + rp->rio_cnt,
+                         RIO_BUFSIZE - rp->rio_cnt);
+    if (nread < 0) {
+      if (errno != EINTR) /* Interrupted by sig handler return */
+        return -1;
+    } else if (nread == 0)
+      break; /* EOF, last line may lack a newline */
+    else
+      rp->rio_cnt += nread;
+  }
+
+  *linep = rp->rio_bufptr;
+  rp->rio_bufptr += n;
+  rp->rio_cnt -= n;
+  return n;
+}
+
+ssize_t Rio_readline_view(rio_t *rp, char **linep) {
+  ssize_t rc = rio_readline_view(rp, linep);
+  if (rc < 0)
+    unix_error("Rio_readline_view error");
+  return rc;
+}
+
+/*
+ * Buffered output. Data is collected in rio_wbuf_t until the buffer fills
+ * up or rio_flushb is called. Data that does not fit is written together
+ * with buffered contents by a single writev call.
+ */
+
+/* rio_writevn - Robustly write all data described by iov (unbuffered).
+ *    Array of iovec structures is modified on partial write. */
+static ssize_t rio_writevn(int fd, struct iovec *iov, int iovcnt) {
+  size_t n = 0;
+
+  while (iovcnt > 0) {
+    ssize_t nwritten = writev(fd, iov, iovcnt);
+    if (nwritten < 0) {
+      if (errno != EINTR) /* Interrupted by sig handler return */
+        return -1;        /* errno set by writev() */
+      continue;
+    }
+    n += nwritten;
+    /* Skip segments that were written, adjust the one written partially */
+    while (iovcnt > 0 && nwritten >= iov->iov_len) {
+      nwritten -= iov->iov_len;
+      iov++, iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + nwritten;
+      iov->iov_len -= nwritten;
+    }
+  }
+  return n;
+}
+
+/* rio_writeinitb - Associate a descriptor with a write buffer */
+void rio_writeinitb(rio_wbuf_t *wp, int fd) {
+  wp->rio_fd = fd;
+  wp->rio_cnt = 0;
+}
+
+/* rio_writevb - Append segments to the buffer. If they do not fit, then
+ *    buffered data and all segments are written at once. */
+ssize_t rio_writevb(rio_wbuf_t *wp, const struct iovec *iov, int iovcnt) {
+  size_t n = 0;
+
+  for (int i = 0; i < iovcnt; i++)
+    n += iov[i].iov_len;
+
+  if (wp->rio_cnt + n <= RIO_BUFSIZE) {
+    for (int i = 0; i < iovcnt; i++) {
+      memcpy(wp->rio_buf + wp->rio_cnt, iov[i].iov_base, iov[i].iov_len);
+      wp->rio_cnt += iov[i].iov_len;
+    }
+    return n;
+  }
+
+  struct iovec vec[iovcnt + 1];
+  vec[0].iov_base = wp->rio_buf;
+  vec[0].iov_len = wp->rio_cnt;
+  memcpy(&vec[1], iov, sizeof(struct iovec) * iovcnt);
+
+  if (rio_writevn(wp->rio_fd, vec, iovcnt + 1) < 0)
+    return -1;
+  wp->rio_cnt = 0;
+  return n;
+}
+
+/* rio_writeb - Append n bytes to the buffer */
+ssize_t rio_writeb(rio_wbuf_t *wp, const void *usrbuf, size_t n) {
+  struct iovec iov = {.iov_base = (void *)usrbuf, .iov_len = n};
+  return rio_writevb(wp, &iov, 1);
+}
+
+/* rio_printfb - Format a message directly into the buffer */
+ssize_t rio_printfb(rio_wbuf_t *wp, const char *fmt, ...) {
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(wp->rio_buf + wp->rio_cnt, RIO_BUFSIZE - wp->rio_cnt, fmt, ap);
+  va_end(ap);
+
+  if (n < 0)
+    return -1;
+
+  /* Message was truncated, so make room for it or use a temporary buffer */
+  if (wp->rio_cnt + n >= RIO_BUFSIZE) {
+    char *str;
+    va_start(ap, fmt);
+    n = vasprintf(&str, fmt, ap);
+    va_end(ap);
+    if (n < 0)
+      return -1;
+    n = rio_writeb(wp, str, n);
+    free(str);
+    return n;
+  }
+
+  wp->rio_cnt += n;
+  return n;
+}
+
+/* rio_flushb - Write out buffered data */
+ssize_t rio_flushb(rio_wbuf_t *wp) {
+  ssize_t n = wp->rio_cnt;
+
+  if (n > 0 && rio_writen(wp->rio_fd, wp->rio_buf, n) < 0)
+    return -1;
+  wp->rio_cnt = 0;
+  return n;
+}
+
+void Rio_writevb(rio_wbuf_t *wp, const struct iovec *iov, int iovcnt) {
+  if (rio_writevb(wp, iov, iovcnt) < 0)
+    unix_error("Rio_writevb error");
+}
+
+void Rio_writeb(rio_wbuf_t *wp, const void *usrbuf, size_t n) {
+  if (rio_writeb(wp, usrbuf, n) < 0)
+    unix_error("Rio_writeb error");
+}
+
+void Rio_flushb(rio_wbuf_t *wp) {
+  if (rio_flushb(wp) < 0)
+    unix_error("Rio_flushb error");
+}
@@ -0,0 +1,360 @@
+#include "shell.h"
+#include "queue.h"
+
+/*
+ * Command line grammar:
+ *
+ *   list     := and_or ((';' | '&') and_or)* [';' | '&']
+ *   and_or   := pipeline (('&&' | '||') pipeline)*
+ *   pipeline := ['time'] ['!'] command ('|' command)*
+ *   command  := (word | procsub | redirect word)+
+ *   procsub  := ('<(' | '>(') command ('|' command)* ')'
+ *   redirect := [digit | '&'] ('<' | '<&' | '<<' | '<<<' | '>' | '>&' | '>>')
+ *
+ * Operators of and-or list have equal precedence and associate to the left,
+ * hence a list can be evaluated from left to right without building a tree.
+ * Redirections are compiled into an array that is kept along with pipelines,
+ * so executing a command does not need to look at operators again. Process
+ * substitution is lexed as a single word and parsed when it's executed.
+ */
+
+static const char *tokname(const char *line, const token_t *tok, int *lenp)
+{
+  if (tok->kind == T_NULL)
+  {
+    *lenp = strlen("newline");
+    return "newline";
+  }
+  *lenp = tok->length;
+  return line + tok->offset;
+}
+
+static void syntax_error(const char *line, const token_t *tok)
+{
+  int len;
+  const char *name = tokname(line, tok, &len);
+  msg("syntax error near unexpected token '%.*s'\n", len, name);
+}
+
+/* Compile redirection operator at token i and the word that follows it.
+ * Operator '&>' stands for two redirections. Here-documents and here-strings
+ * only record their word, input is read when the command line is executed.
+ * Returns number of redirections put into r, or -1 if the word is not a valid
+ * descriptor. */
+static int mkredir(const char *line, const token_t *token, int i, redir_t *r)
+{
+  const token_t *word = &token[i + 1];
+  const char *op = line + token[i].offset;
+  const char *w = line + word->offset;
+  bool both = false;
+
+  r->offset = word->offset;
+  r->length = word->length;
+  r->fd = (token[i].kind == T_INPUT) ? 0 : 1;
+  r->dup = R_OPEN;
+
+  if (token[i].kind == T_INPUT)
+    r->flags = O_RDONLY;
+  else if (token[i].kind == T_APPEND)
+    r->flags = O_WRONLY | O_CREAT | O_APPEND;
+  else
+    r->flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+  if (op[0] == '&')
+    both = true;
+  else if (op[0] >= '0' && op[0] <= '9')
+    r->fd = op[0] - '0';
+
+  const char *end = op + token[i].length;
+  const char *lt = memchr(op, '<', token[i].length);
+  if (lt != NULL && end - lt >= 2 && lt[1] == '<')
+  {
+    r->dup = (end - lt == 3) ? R_HERESTR : R_HEREDOC;
+    return 1;
+  }
+
+  if (end[-1] == '&')
+  {
+    if (!both && word->length == 1 && w[0] == '-')
+      r->dup = R_CLOSE;
+    else if (!both && word->length == 1 && w[0] >= '0' && w[0] <= '9')
+      r->dup = w[0] - '0';
+    else
+    {
+      msg("%.*s: bad file descriptor\n", (int)word->length, w);
+      return -1;
+    }
+    /* Duplicating a descriptor onto itself does nothing. */
+    return r->dup != r->fd;
+  }
+
+  if (!both)
+    return 1;
+
+  r[1] = r[0];
+  r[1].fd = STDERR_FILENO;
+  r[1].dup = STDOUT_FILENO;
+  return 2;
+}
+
+/* Check a pipeline that spans tokens from i up to the next separator and
+ * compile its redirections into redir array. Returns index of the separator
+ * or -1 if pipeline is malformed. */
+static int pipeline(const char *line, const token_t *token, int i,
+                    node_t *node, redir_t *redir)
+{
+  node->timed = false;
+  node->negate = false;
+
+  if (tokeq(line, &token[i], "time") && !separator_p(token[i + 1]))
+  {
+    node->timed = true;
+    i++;
+  }
+
+  if (token[i].kind == T_BANG)
+  {
+    node->negate = true;
+    i++;
+  }
+
+  node->token = i;
+  node->nredirs = 0;
+
+  /* Only a simple command may consist of redirections alone. */
+  for (bool words = false, redirs = false, piped = false;; i++)
+  {
+    int kind = token[i].kind;
+
+    if (kind == T_WORD)
+    {
+      const token_t *tok = &token[i];
+      if (procsub_p(line, *tok) && line[tok->offset + tok->length - 1] != ')')
+      {
+        syntax_error(line, &token[i + 1]);
+        return -1;
+      }
+      words = true;
+    }
+    else if (redir_p(token[i]))
+    {
+      if (!string_p(token[i + 1]) || procsub_p(line, token[i + 1]))
+      {
+        syntax_error(line, &token[i + 1]);
+        return -1;
+      }
+      int n = mkredir(line, token, i, &redir[node->redir + node->nredirs]);
+      if (n < 0)
+        return -1;
+      node->nredirs += n;
+      redirs = true;
+      i++;
+    }
+    else if (kind == T_PIPE || separator_p(token[i]))
+    {
+      if (!words && (piped || kind == T_PIPE || !redirs))
+      {
+        syntax_error(line, &token[i]);
+        return -1;
+      }
+      if (kind != T_PIPE)
+        break;
+      words = redirs = false;
+      piped = true;
+    }
+    else
+    {
+      syntax_error(line, &token[i]);
+      return -1;
+    }
+  }
+
+  node->ntokens = i - node->token;
+  return i;
+}
+
+/* Turn command line into an array of pipelines. Returns NULL and reports
+ * an error if the command line is malformed. Token array must be terminated
+ * with T_NULL, as returned by tokenize. Redirections of all pipelines are
+ * stored in a single array returned through redirp. */
+node_t *parse(arena_t *a, const char *line, const token_t *token, int ntokens,
+              redir_t **redirp, int *nnodesp)
+{
+  int nnodes = 0, nredirs = 0;
+  int nmax = 1, rmax = 0;
+
+  for (int i = 0; i < ntokens; i++)
+  {
+    if (separator_p(token[i]))
+      nmax++;
+    else if (redir_p(token[i]))
+      rmax += 2;
+  }
+
+  node_t *node = arena_alloc(a, sizeof(node_t) * nmax);
+  redir_t *redir = arena_alloc(a, sizeof(redir_t) * rmax);
+  int first = 0; /* first pipeline of current and-or list */
+
+  for (int i = 0; i < ntokens;)
+  {
+    node_t *nd = &node[nnodes];
+
+    nd->link = (nnodes == first) ? T_COLON : token[i - 1].kind;
+    nd->bg = false;
+    nd->redir = nredirs;
+
+    if ((i = pipeline(line, token, i, nd, redir)) < 0)
+      return NULL;
+    nredirs += nd->nredirs;
+    nnodes++;
+
+    int kind = token[i].kind;
+    if (kind == T_NULL)
+      break;
+    i++;
+
+    if (kind == T_AND || kind == T_OR)
+    {
+      if (i == ntokens)
+      {
+        syntax_error(line, &token[i]);
+        return NULL;
+      }
+      continue;
+    }
+
+    /* T_COLON or T_BGJOB ends and-or list */
+    if (kind == T_BGJOB)
+    {
+      if (nnodes - first > 1)
+      {
+        msg("background and-or lists are not supported\n");
+        return NULL;
+      }
+      node[first].bg = true;
+    }
+    first = nnodes;
+  }
+
+  *redirp = redir;
+  *nnodesp = nnodes;
+  return node;
+}
+
+/*
+ * Cache of parsed command lines. Lines typed again from history or repeated
+ * by scripts skip lexing and parsing altogether. Entries are indexed by hash
+ * of line text and the least recently used one is evicted when cache is full.
+ * Tokens refer to the line by offsets, so they are valid for any copy of it.
+ */
+#define NLINES 512
+#define NLINEBUCKETS 256
+
+typedef struct lineent
+{
+  LIST_ENTRY(lineent) link; /* entries with the same bucket */
+  TAILQ_ENTRY(lineent) lru; /* most recently used entries go first */
+  uint32_t hash;            /* jenkins_hash of line text */
+  size_t len;               /* length of line text */
+  const char *line;         /* copy of line text, not terminated with NUL */
+  token_t *token;           /* tokens terminated with T_NULL */
+  node_t *node;             /* pipelines of the line */
+  redir_t *redir;           /* redirections of all pipelines */
+  int nnodes;               /* number of pipelines */
+} lineent_t;
+
+static LIST_HEAD(linelist, lineent) linetab[NLINEBUCKETS];
+static TAILQ_HEAD(linequeue, lineent) linelru = TAILQ_HEAD_INITIALIZER(linelru);
+static int nlines = 0;
+static unsigned linehits = 0;
+static unsigned linemisses = 0;
+
+static void dellineent(lineent_t *ent)
+{
+  LIST_REMOVE(ent, link);
+  TAILQ_REMOVE(&linelru, ent, lru);
+  free(ent);
+  nlines--;
+}
+
+/* Entry with all its arrays and text is kept in a single block of memory. */
+static void addlineent(uint32_t hash, const char *line, size_t len,
+                       const token_t *token, int ntokens, const node_t *node,
+                       int nnodes, const redir_t *redir)
+{
+  if (nlines == NLINES)
+    dellineent(TAILQ_LAST(&linelru, linequeue));
+
+  size_t tsize = sizeof(token_t) * (ntokens + 1);
+  size_t nsize = sizeof(node_t) * nnodes;
+  size_t rsize = 0;
+  if (nnodes > 0)
+    rsize = sizeof(redir_t) * (node[nnodes - 1].redir +
+                               node[nnodes - 1].nredirs);
+  lineent_t *ent = Malloc(sizeof(lineent_t) + tsize + nsize + rsize + len);
+
+  ent->hash = hash;
+  ent->len = len;
+  ent->token = memcpy(&ent[1], token, tsize);
+  ent->node = memcpy((char *)ent->token + tsize, node, nsize);
+  ent->redir = memcpy((char *)ent->node + nsize, redir, rsize);
+  ent->line = memcpy((char *)ent->redir + rsize, line, len);
+  ent->nnodes = nnodes;
+
+  LIST_INSERT_HEAD(&linetab[hash % NLINEBUCKETS], ent, link);
+  TAILQ_INSERT_HEAD(&linelru, ent, lru);
+  nlines++;
+}
+
+/* Like parse, but takes raw command line and consults the cache first.
+ * Tokens and nodes found in the cache must not be modified. */
+node_t *parseline(arena_t *a, const char *line, size_t len, token_t **tokenp,
+                  redir_t **redirp, int *nnodesp)
+{
+  uint32_t hash = jenkins_hash(line, len, HASHINIT);
+  struct linelist *bucket = &linetab[hash % NLINEBUCKETS];
+
+  lineent_t *ent;
+  LIST_FOREACH(ent, bucket, link)
+  {
+    if (ent->hash != hash || ent->len != len || memcmp(ent->line, line, len))
+      continue;
+    TAILQ_REMOVE(&linelru, ent, lru);
+    TAILQ_INSERT_HEAD(&linelru, ent, lru);
+    linehits++;
+    *tokenp = ent->token;
+    *redirp = ent->redir;
+    *nnodesp = ent->nnodes;
+    return ent->node;
+  }
+
+  linemisses++;
+
+  int ntokens, nnodes = 0;
+  redir_t *redir = NULL;
+  token_t *token = tokenize(a, line, len, &ntokens);
+  node_t *node = parse(a, line, token, ntokens, &redir, &nnodes);
+
+  /* Malformed lines are not remembered, so the error is reported again. */
+  if (node != NULL)
+    addlineent(hash, line, len, token, ntokens, node, nnodes, redir);
+
+  *tokenp = token;
+  *redirp = redir;
+  *nnodesp = nnodes;
+  return node;
+}
+
+void flushlines(void)
+{
+  lineent_t *ent;
+  while ((ent = TAILQ_FIRST(&linelru)))
+    dellineent(ent);
+  linehits = linemisses = 0;
+}
+
+void prlinestats(int fd)
+{
+  dprintf(fd, "%d lines cached, %u hits, %u misses\n", nlines, linehits,
+          linemisses);
+}
@@ -1,10 +1,29 @@
 #include <readline/readline.h>
 #include <readline/history.h>
+#include <spawn.h>
 
 #define DEBUG 0
 #include "shell.h"
 
 sigset_t sigchld_mask;
+sigset_t child_mask;
+bool interactive = false;
+
+int pipe_size = 0;          /* initial capacity of pipes, 0 for default */
+bool pipe_adaptive = false; /* grow pipes of foreground jobs when they fill */
+
+bool uncat = false;       /* drop leading 'cat file' stages of pipelines */
+unsigned uncat_saved = 0; /* number of processes not started thanks to that */
+
+/* Temporaries of the command line being evaluated, released by eval. */
+static arena_t line_arena;
+
+/* Input of the shell is read line by line through nextline, which is also
+ * used to read bodies of here-documents. Returned line is not terminated with
+ * newline nor NUL and it is valid until the next call. */
+static const char *(*nextline)(size_t *lenp);
+
+static int last_status; /* exit status of the most recent command line */
 
 static sigjmp_buf loop_env;
 
@@ -23,273 +42,959 @@ static void MaybeClose(int *fdp)
   *fdp = -1;
 }
 
-/* Consume all tokens related to redirection operators.
- * Put opened file descriptors into inputp & output respectively. */
-static int do_redir(token_t *token, int ntokens, int *inputp, int *outputp)
+/* Descriptors of the shell saved while a builtin runs with redirections.
+ * Descriptor that was closed is saved as -1, so it gets closed again. */
+static int saved_fds[10];
+static unsigned saved_mask; /* descriptors that have been saved */
+
+static char *redirpath(const char *line, const redir_t *r)
 {
-  token_t mode = NULL; /* T_INPUT, T_OUTPUT or NULL */
-  int n = 0;           /* number of tokens after redirections are removed */
+  return arena_strndup(&line_arena, line + r->offset, r->length);
+}
 
-  for (int i = 0; i < ntokens; i++)
+/* Carry out redirections in the current process. A file is moved onto
+ * descriptor it redirects, unless it happened to be opened there already.
+ * Returns false and reports an error if any of redirections fails. */
+static bool do_redir(const char *line, const redir_t *redir, int nredirs)
+{
+  for (const redir_t *r = redir; r < redir + nredirs; r++)
   {
-    /* TODO: Handle tokens and open files as requested. */
-    mode = token[i];
-    if (mode == NULL)
-      return i;
-    if (mode == T_INPUT || mode == T_OUTPUT)
+    if (r->dup == R_CLOSE)
     {
-      assert(i + 1 < ntokens && token[i + 1] != NULL && "redir operator without a filename");
-      assert(token[i + 1] >= (token_t)10 && "bad syntax: another operator just after the first one");
-      if (mode == T_INPUT)
+      close(r->fd);
+    }
+    else if (r->dup >= 0)
+    {
+      if (dup2(r->dup, r->fd) < 0)
+      {
+        msg("%d: %s\n", r->dup, strerror(errno));
+        return false;
+      }
+    }
+    else
+    {
+      char *path = redirpath(line, r);
+      int fd = open(path, r->flags, DEFFILEMODE);
+      if (fd < 0)
       {
-        MaybeClose(inputp);
-        *inputp = Open(token[i + 1], O_RDONLY, 0);
+        msg("%s: %s\n", path, strerror(errno));
+        return false;
       }
-      else //mode == T_OUTPUT
+      if (fd != r->fd)
       {
-        MaybeClose(outputp);
-        *outputp = Open(token[i + 1], O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR | S_IRGRP);
+        dup2(fd, r->fd);
+        close(fd);
       }
-      for (int j = i + 2; j < ntokens; j++)
-        token[j - 2] = token[j];
-      ntokens -= 2;
-      i--;
     }
   }
-  n = ntokens;
-  token[n] = NULL;
-  return n;
+  return true;
 }
 
-/* Execute internal command within shell's process or execute external command
- * in a subprocess. External command can be run in the background. */
-static int do_job(token_t *token, int ntokens, bool bg)
+/* Apply redirections to the shell itself, saving descriptors they replace,
+ * so that a builtin can be executed in shell's process. */
+static bool redir_push(const char *line, const redir_t *redir, int nredirs)
 {
-  int input = -1, output = -1;
-  int exitcode = 0;
-
-  ntokens = do_redir(token, ntokens, &input, &output);
-
-  if (!bg)
+  for (const redir_t *r = redir; r < redir + nredirs; r++)
   {
-    if ((exitcode = builtin_command(token)) >= 0)
-      return exitcode;
+    if (saved_mask & (1U << r->fd))
+      continue;
+    saved_fds[r->fd] = fcntl(r->fd, F_DUPFD_CLOEXEC, 10);
+    saved_mask |= 1U << r->fd;
   }
+  return do_redir(line, redir, nredirs);
+}
 
-  sigset_t mask;
-  Sigprocmask(SIG_BLOCK, &sigchld_mask, &mask);
+/* Bring back descriptors saved by redir_push. */
+static void redir_pop(void)
+{
+  for (int fd = 0; saved_mask; fd++)
+  {
+    if (!(saved_mask & (1U << fd)))
+      continue;
+    if (saved_fds[fd] < 0)
+      close(fd);
+    else
+      Dup2(saved_fds[fd], fd);
+    MaybeClose(&saved_fds[fd]);
+    saved_mask &= ~(1U << fd);
+  }
+}
 
-  /* TODO: Start a subprocess, create a job and monitor it. */
+/* Make argument vector out of words that are neither redirection operators
+ * nor their targets. Returns NULL if there are no such words. Tokens are left
+ * intact, as they may be reused for another execution. */
+static char **cmdargv(const char *line, const token_t *token, int ntokens)
+{
+  token_t *word = arena_alloc(&line_arena, sizeof(token_t) * ntokens);
+  int n = 0;
 
-  pid_t pid = Fork();
+  for (int i = 0; i < ntokens; i++)
+  {
+    if (redir_p(token[i]))
+      i++;
+    else
+      word[n++] = token[i];
+  }
+  return n > 0 ? mkargv(&line_arena, line, word, n) : NULL;
+}
 
-  if (pid == 0) //child
+/* Plan of a single pipeline stage. Descriptors are close-on-exec and will be
+ * installed as standard input & output of the stage, or -1 if not connected.
+ * Redirections of the stage are applied afterwards. */
+typedef struct stage
+{
+  const token_t *token; /* command and its arguments */
+  int ntokens;          /* number of tokens in the stage */
+  int input;            /* read end of a pipe from the previous stage */
+  int output;           /* write end of a pipe to the next stage */
+  const redir_t *redir; /* redirections of the stage */
+  int nredirs;          /* number of redirections */
+  char **argv;          /* argument vector, made when the stage is started */
+  int *subfd;           /* pipes named by arguments as /dev/fd/N */
+  int nsubs;            /* number of process substitutions */
+} stage_t;
+
+/* Processes of a job are registered as they are started. Job is created along
+ * with its first process, which also becomes leader of its process group. */
+typedef struct launch
+{
+  pid_t pgid; /* process group of the job, 0 if nothing was started yet */
+  int job;    /* job identifier, valid once pgid is known */
+  int nproc;  /* expected number of processes */
+  bool bg;    /* job is run in the background */
+  bool timed; /* resource usage of the job is reported */
+  int nested; /* depth of process substitution being started */
+} launch_t;
+
+/* Commands of process substitutions are left out of job's description. */
+static void launched(launch_t *l, pid_t pid, char **argv)
+{
+  if (l->pgid == 0)
   {
-    sigprocmask(SIG_SETMASK, &mask, NULL);
-    if (input != -1)
-      dup2(input, 0);
-    if (output != -1)
-      dup2(output, 1);
-    setpgid(0, 0);
-    Signal(SIGINT, SIG_DFL);
-    Signal(SIGTSTP, SIG_DFL);
-    Signal(SIGTTIN, SIG_DFL);
-    Signal(SIGTTOU, SIG_DFL);
-    if (builtin_command(token) >= 0)
-      exit(0);
-    //assert to check whether the tokens vector is a vector of strings and not shell operators
-    for (int i = 0; i < ntokens; i++)
-      assert((token[i] == NULL || token[i] >= (token_t)10) && "shell operator in argv of an external command"); //10==(max of value of shell operator)+1
-    external_command(token);
+    l->pgid = pid;
+    l->job = addjob(pid, l->bg, l->nproc);
+    if (l->timed)
+      timejob(l->job);
   }
-  //else // parent
-  setpgid(pid, pid);
-  MaybeClose(&input);
-  MaybeClose(&output);
-  int job_id = addjob(pid, bg);
-  addproc(job_id, pid, token);
-  if (!bg)
-    exitcode = monitorjob(&mask);
+  addproc(l->job, pid, l->nested ? NULL : argv);
+}
 
-  Sigprocmask(SIG_SETMASK, &mask, NULL);
-  return exitcode;
+/* Close descriptors of the shell in a subprocess, as exec would do, once
+ * redirections are applied. Descriptors 3-9 can be named by redirections,
+ * so only close-on-exec ones go. The rest is shell's own range (see movefd),
+ * of which only pipes of process substitutions are inherited by the command.
+ */
+static void closefds(const int *keep, int nkeep)
+{
+  for (int fd = 3; fd < 10; fd++)
+    if (fcntl(fd, F_GETFD) > 0)
+      close(fd);
+
+  for (unsigned fd = 10;;)
+  {
+    unsigned next = ~0U; /* lowest descriptor to keep above fd */
+    for (int i = 0; i < nkeep; i++)
+      if ((unsigned)keep[i] >= fd && (unsigned)keep[i] < next)
+        next = keep[i];
+    if (next > fd)
+      close_range(fd, next - 1, 0);
+    if (next == ~0U)
+      break;
+    fcntl(next, F_SETFD, 0);
+    fd = next + 1;
+  }
 }
 
-/* Start internal or external command in a subprocess that belongs to pipeline.
- * All subprocesses in pipeline must belong to the same process group. */
-static pid_t do_stage(pid_t pgid, sigset_t *mask, int input, int output,
-                      token_t *token, int ntokens)
+/* Start a subprocess in process group pgid, or in a new one if pgid is 0.
+ * Foreground subprocess takes the terminal over before it starts executing
+ * the command, otherwise it could be stopped by SIGTTIN. Without job control
+ * subprocesses stay in shell's process group and the terminal is left alone.
+ * External commands are started with posix_spawn, which does not duplicate
+ * shell's address space and lets the child open redirected files itself.
+ * Builtins, which need a copy of the shell, and commands that could not be
+ * spawned fall back to fork. A failed redirection is reported by the child. */
+static pid_t spawn(pid_t pgid, bool fg, const char *line, const stage_t *st)
 {
-  ntokens = do_redir(token, ntokens, &input, &output);
+  char **argv = st->argv;
+  const char *path = findcommand(argv[0]);
+  pid_t pid;
 
-  if (ntokens == 0)
-    app_error("ERROR: Command line is not well formed!");
+  if (path != NULL && !builtin_p(argv[0]))
+  {
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    sigset_t sigdef;
+
+    sigemptyset(&sigdef);
+    sigaddset(&sigdef, SIGINT);
+    sigaddset(&sigdef, SIGTSTP);
+    sigaddset(&sigdef, SIGTTIN);
+    sigaddset(&sigdef, SIGTTOU);
+
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, (interactive ? POSIX_SPAWN_SETPGROUP : 0) |
+                                      POSIX_SPAWN_SETSIGDEF |
+                                      POSIX_SPAWN_SETSIGMASK);
+    posix_spawnattr_setpgroup(&attr, pgid);
+    posix_spawnattr_setsigdefault(&attr, &sigdef);
+    posix_spawnattr_setsigmask(&attr, &child_mask);
+
+    posix_spawn_file_actions_init(&actions);
+    if (fg && interactive)
+      posix_spawn_file_actions_addtcsetpgrp_np(&actions, tty_fd);
+    if (st->input != -1)
+      posix_spawn_file_actions_adddup2(&actions, st->input, STDIN_FILENO);
+    if (st->output != -1)
+      posix_spawn_file_actions_adddup2(&actions, st->output, STDOUT_FILENO);
+    for (const redir_t *r = st->redir; r < st->redir + st->nredirs; r++)
+    {
+      if (r->dup == R_OPEN)
+        posix_spawn_file_actions_addopen(&actions, r->fd, redirpath(line, r),
+                                         r->flags, DEFFILEMODE);
+      else if (r->dup == R_CLOSE)
+        posix_spawn_file_actions_addclose(&actions, r->fd);
+      else
+        posix_spawn_file_actions_adddup2(&actions, r->dup, r->fd);
+    }
+    /* Duplicating a descriptor onto itself clears its close-on-exec flag. */
+    for (int i = 0; i < st->nsubs; i++)
+      posix_spawn_file_actions_adddup2(&actions, st->subfd[i], st->subfd[i]);
 
-  /* TODO: Start a subprocess and make sure it's moved to a process group. */
-  pid_t pid = Fork();
+    int error = posix_spawn(&pid, path, &actions, &attr, argv, environ);
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (!error)
+      return pid;
+    debug("spawn: %s: %s, falling back to fork\n", path, strerror(error));
+  }
+
+  pid = Fork();
   if (pid == 0) //child
   {
-    sigprocmask(SIG_SETMASK, mask, NULL);
-    if (input != -1)
-      dup2(input, 0);
-    if (output != -1)
-      dup2(output, 1);
-    setpgid(0, pgid);
+    if (st->input != -1)
+      dup2(st->input, 0);
+    if (st->output != -1)
+      dup2(st->output, 1);
+    if (interactive)
+      setpgid(0, pgid);
+    if (fg && interactive)
+      tcsetpgrp(tty_fd, getpgrp());
+    if (!do_redir(line, st->redir, st->nredirs))
+      exit(1);
+    closefds(st->subfd, st->nsubs);
+    sigprocmask(SIG_SETMASK, &child_mask, NULL);
     Signal(SIGINT, SIG_DFL);
     Signal(SIGTSTP, SIG_DFL);
     Signal(SIGTTIN, SIG_DFL);
     Signal(SIGTTOU, SIG_DFL);
-    if (builtin_command(token) >= 0)
-      exit(0);
-    //assert to check whether the tokens vector is a vector of strings and not shell operators
-    for (int i = 0; i < ntokens; i++)
-      assert((token[i] == NULL || token[i] >= (token_t)10) && "shell operator in argv of an external command"); //10==(max of value of shell operator)+1
-    external_command(token);
+    int status = builtin_command(argv);
+    if (status >= 0)
+      exit(status);
+    external_command(path, argv);
   }
-  if (pgid == 0)
-    setpgid(pid, pid);
-  else
-    setpgid(pid, pgid);
-  MaybeClose(&input);
-  MaybeClose(&output);
+  if (interactive)
+    setpgid(pid, pgid ? pgid : pid);
   return pid;
 }
 
+/* Largest pipe capacity an unprivileged process may request. */
+int pipe_max_size(void)
+{
+  static int size = 0;
+
+  if (size == 0)
+  {
+    FILE *f = fopen("/proc/sys/fs/pipe-max-size", "r");
+    if (f == NULL || fscanf(f, "%d", &size) != 1)
+      size = 1024 * 1024;
+    if (f)
+      fclose(f);
+  }
+  return size;
+}
+
 static void mkpipe(int *readp, int *writep)
 {
   int fds[2];
-  Pipe(fds);
-  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
-  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  Pipe2(fds, O_CLOEXEC);
+  if (pipe_size > 0 &&
+      fcntl(fds[1], F_SETPIPE_SZ, min(pipe_size, pipe_max_size())) < 0)
+    debug("pipe: cannot set size to %d: %s\n", pipe_size, strerror(errno));
   *readp = fds[0];
   *writep = fds[1];
 }
 
-/* Pipeline execution creates a multiprocess job. Both internal and external
- * commands are executed in subprocesses. */
-static int do_pipeline(token_t *token, int ntokens, bool bg)
+static void start_pipeline(launch_t *l, const char *line,
+                           const token_t *token, int ntokens,
+                           const redir_t *redir, int nredirs, int input,
+                           int output);
+
+/* Start pipeline of process substitution <(...) or >(...) given as word token
+ * of a stage. Its output or input respectively is connected with a pipe, whose
+ * other end is returned to be passed to the stage. Returns -1 if the pipeline
+ * is malformed. */
+static int do_procsub(launch_t *l, const char *line, const token_t *tok)
 {
-  pid_t pid, pgid = 0;
-  int job = -1;
-  int exitcode = 0;
+  const char *cmd = line + tok->offset + 2;
+  size_t len = tok->length - 3;
+  int ntokens, nnodes = 0;
+  redir_t *redir;
+  int fd, input = -1, output = -1;
+
+  token_t *token = tokenize(&line_arena, cmd, len, &ntokens);
+  node_t *node = parse(&line_arena, cmd, token, ntokens, &redir, &nnodes);
+
+  if (node == NULL)
+    return -1;
+  if (nnodes != 1 || node->bg || node->negate || node->timed)
+  {
+    msg("process substitution must be a single pipeline\n");
+    return -1;
+  }
 
-  int input = -1, output = -1, next_input = -1;
+  if (line[tok->offset] == '<')
+    mkpipe(&fd, &output);
+  else
+    mkpipe(&input, &fd);
+  l->nested++;
+  start_pipeline(l, cmd, &token[node->token], node->ntokens, redir,
+                 node->nredirs, input, output);
+  l->nested--;
+  return movefd(fd);
+}
+
+/* Replace arguments of the stage that are process substitutions with names
+ * of pipes that lead to commands started in their place. */
+static bool do_procsubs(launch_t *l, const char *line, stage_t *st)
+{
+  st->nsubs = 0;
 
-  mkpipe(&next_input, &output);
+  for (int i = 0, n = 0; i < st->ntokens; i++)
+  {
+    if (redir_p(st->token[i]))
+    {
+      i++;
+      continue;
+    }
+    if (procsub_p(line, st->token[i]))
+    {
+      int fd = do_procsub(l, line, &st->token[i]);
+      if (fd < 0)
+        return false;
+      st->subfd[st->nsubs++] = fd;
+      st->argv[n] = arena_alloc(&line_arena, sizeof("/dev/fd/") + 10);
+      sprintf(st->argv[n], "/dev/fd/%d", fd);
+    }
+    n++;
+  }
+  return true;
+}
 
-  sigset_t mask;
-  Sigprocmask(SIG_BLOCK, &sigchld_mask, &mask);
+/* Start internal or external command in a subprocess that belongs to pipeline.
+ * All subprocesses in pipeline must belong to the same process group. Process
+ * substitutions of the stage are started before it and join the same job.
+ * Returns false if the stage could not be started. */
+static bool do_stage(launch_t *l, const char *line, stage_t *st)
+{
+  int subfd[st->ntokens];
+  bool ok;
 
-  /* TODO: Start pipeline subprocesses, create a job and monitor it.
-   * Remember to close unused pipe ends! */
+  if (st->argv == NULL)
+    app_error("ERROR: Command line is not well formed!");
 
-  int latest_t_pipe = -1;
-  int flags;
+  st->subfd = subfd;
+  if ((ok = do_procsubs(l, line, st)))
+  {
+    /* TODO: Start a subprocess and make sure it's moved to a process group. */
+    pid_t pid = spawn(l->pgid, !l->bg, line, st);
+    launched(l, pid, st->argv);
+  }
 
-  flags = fcntl(output, F_GETFD);
-  fcntl(output, F_SETFD, flags & ~FD_CLOEXEC);
+  for (int i = 0; i < st->nsubs; i++)
+    Close(subfd[i]);
+  MaybeClose(&st->input);
+  MaybeClose(&st->output);
+  return ok;
+}
 
+static bool has_procsub(const char *line, const token_t *token, int ntokens)
+{
   for (int i = 0; i < ntokens; i++)
+    if (procsub_p(line, token[i]))
+      return true;
+  return false;
+}
+
+/* Execute internal command within shell's process or execute external command
+ * in a subprocess. External command can be run in the background. */
+static int do_job(const char *line, const token_t *token, int ntokens,
+                  const redir_t *redir, int nredirs, bool bg, bool timed)
+{
+  stage_t st = {.token = token, .ntokens = ntokens, .input = -1,
+                .output = -1, .redir = redir, .nredirs = nredirs};
+  int exitcode = 0;
+
+  char **argv = st.argv = cmdargv(line, token, ntokens);
+
+  /* Files named by a command made of redirections alone are created. */
+  if (argv == NULL)
+  {
+    if (!redir_push(line, redir, nredirs))
+      exitcode = 1;
+    redir_pop();
+    return exitcode;
+  }
+
+  if (!bg && shell_builtin_p(argv[0]) && !has_procsub(line, token, ntokens))
   {
-    if (token[i] == T_PIPE)
+    struct timeval start, finish;
+    struct rusage before, after;
+
+    if (timed)
     {
-      assert(i + 1 < ntokens && token[i + 1] >= (token_t)10 && "bad syntax: operator or end of command after pipe symbol");
-      if (pgid == 0)
-      {
-        pid = do_stage(pgid, &mask, input, output, token, i);
-        pgid = pid;
-        latest_t_pipe = i;
-        job = addjob(pgid, bg);
-        token[i] = NULL;
-        addproc(job, pid, token);
-      }
-      else
+      gettime(&start);
+      getrusage(RUSAGE_SELF, &before);
+    }
+    if (redir_push(line, redir, nredirs))
+      exitcode = builtin_command(argv);
+    else
+      exitcode = 1;
+    redir_pop();
+    /* Builtin may decline arguments it does not handle, e.g. 'kill 1234',
+     * and leave them to an external command of the same name. */
+    if (exitcode >= 0)
+    {
+      if (timed)
       {
-        pid = do_stage(pgid, &mask, input, output, &token[latest_t_pipe + 1], i - latest_t_pipe - 1);
-        addproc(job, pid, &token[latest_t_pipe + 1]);
-        latest_t_pipe = i;
-        token[i] = NULL;
+        gettime(&finish);
+        getrusage(RUSAGE_SELF, &after);
+        timersub(&finish, &start, &finish);
+        timersub(&after.ru_utime, &before.ru_utime, &after.ru_utime);
+        timersub(&after.ru_stime, &before.ru_stime, &after.ru_stime);
+        /* Shell's peak RSS says nothing about what the builtin used. */
+        after.ru_maxrss = -1;
+        rio_wbuf_t wb;
+        rio_writeinitb(&wb, STDERR_FILENO);
+        prtimes(&wb, NULL, NULL, NULL);
+        prtimes(&wb, "total", &finish, &after);
+        rio_flushb(&wb);
       }
-      //Zamykam deskryptory potokow w do_stage, bo obsluguje przypadek, ze sa one zastapione przez deskrytory otwarte w do_redir,
-      //a procedura do_stage nie daje mi mozliwosci zwrocenia nowych(tj. otwartych w do_redir) deskryptorow spowrotem do procedury do_pipeline
-      flags = fcntl(next_input, F_GETFD);
-      fcntl(next_input, F_SETFD, flags & ~FD_CLOEXEC);
-      input = next_input;
-      mkpipe(&next_input, &output);
-      flags = fcntl(output, F_GETFD);
-      fcntl(output, F_SETFD, flags & ~FD_CLOEXEC);
+      return exitcode;
     }
   }
-  //wykonujemy koncowa czesc polecenia tj. te po ostatnim znaku '|'
-  MaybeClose(&output);
-  MaybeClose(&next_input);
-  pid = do_stage(pgid, &mask, input, output, &token[latest_t_pipe + 1], ntokens - latest_t_pipe - 1);
-  addproc(job, pid, &token[latest_t_pipe + 1]);
+
+  /* TODO: Start a subprocess, create a job and monitor it. */
+
+  launch_t l = {.nproc = 1, .bg = bg, .timed = timed};
+  bool ok = do_stage(&l, line, &st);
+  if (l.pgid != 0 && !bg)
+    exitcode = monitorjob();
+
+  return ok ? exitcode : 1;
+}
+
+/* Start stages of a pipeline as processes of a job. First stage reads from
+ * input and the last one writes to output, unless those are -1. */
+static void start_pipeline(launch_t *l, const char *line,
+                           const token_t *token, int ntokens,
+                           const redir_t *redir, int nredirs, int input,
+                           int output)
+{
+  int nstages = 1;
+
+  for (int i = 0; i < ntokens; i++)
+    if (token[i].kind == T_PIPE)
+      nstages++;
+
+  /* Split the command line into stages and connect them with pipes first,
+   * so that starting each stage is just a matter of spawning it. Stage gets
+   * redirections whose words precede the pipe that ends it. */
+  stage_t stage[nstages];
+  stage_t *last = stage;
+  const redir_t *r = redir;
+
+  last->token = token;
+  last->input = input;
+  last->redir = r;
+  for (int i = 0; i < ntokens; i++)
+  {
+    if (token[i].kind != T_PIPE)
+      continue;
+    assert(i + 1 < ntokens && "bad syntax: end of command after pipe symbol");
+    last->ntokens = &token[i] - last->token;
+    while (r < redir + nredirs && r->offset < token[i].offset)
+      r++;
+    last->nredirs = r - last->redir;
+    mkpipe(&last[1].input, &last->output);
+    last++;
+    last->token = &token[i + 1];
+    last->redir = r;
+  }
+  last->ntokens = &token[ntokens] - last->token;
+  last->nredirs = redir + nredirs - r;
+  last->output = output;
+
+  /* TODO: Start pipeline subprocesses, create a job and monitor it.
+   * Remember to close unused pipe ends! */
+
+  for (stage_t *st = stage; st <= last; st++)
+  {
+    int probe = -1;
+    if (pipe_adaptive && st->input >= 0)
+      probe = fcntl(st->input, F_DUPFD_CLOEXEC, 3);
+    st->argv = cmdargv(line, st->token, st->ntokens);
+    /* do_stage closes pipe ends passed to the stage */
+    if (do_stage(l, line, st))
+      watchpipe(l->job, probe);
+    else
+      MaybeClose(&probe);
+  }
+}
+
+/* Pipeline execution creates a multiprocess job. Both internal and external
+ * commands are executed in subprocesses. */
+static int do_pipeline(const char *line, const token_t *token, int ntokens,
+                       const redir_t *redir, int nredirs, bool bg, bool timed)
+{
+  launch_t l = {.bg = bg, .timed = timed, .nproc = 1};
+
+  for (int i = 0; i < ntokens; i++)
+    if (token[i].kind == T_PIPE)
+      l.nproc++;
+
+  start_pipeline(&l, line, token, ntokens, redir, nredirs, -1, -1);
+  if (l.pgid == 0)
+    return 1;
   if (!bg)
-    exitcode = monitorjob(&mask);
+    return monitorjob();
+  return 0;
+}
 
-  Sigprocmask(SIG_SETMASK, &mask, NULL);
-  return exitcode;
+/* Rewrite pipeline that begins with 'cat file |' so that the next stage reads
+ * the file with input redirection instead, which saves a process and a pipe.
+ * Redirection goes first, so the stage's own input redirection still wins.
+ * Rewritten pipeline is kept in the arena, as parsed one may be cached. */
+static void do_uncat(const char *line, const token_t **tokenp, int *ntokensp,
+                     const redir_t **redirp, int *nredirsp)
+{
+  const token_t *token = *tokenp;
+
+  if (!tokeq(line, &token[0], "cat") || !string_p(token[1]) ||
+      token[2].kind != T_PIPE || line[token[1].offset] == '-' ||
+      procsub_p(line, token[1]))
+    return;
+
+  redir_t *redir = arena_alloc(&line_arena, sizeof(redir_t) * (*nredirsp + 1));
+  redir[0] = (redir_t){.offset = token[1].offset,
+                       .length = token[1].length,
+                       .flags = O_RDONLY,
+                       .fd = STDIN_FILENO,
+                       .dup = R_OPEN};
+  memcpy(&redir[1], *redirp, sizeof(redir_t) * *nredirsp);
+
+  debug("uncat: '%.*s' reads '%.*s' by itself\n", (int)token[3].length,
+        line + token[3].offset, (int)token[1].length, line + token[1].offset);
+
+  *tokenp = &token[3];
+  *ntokensp -= 3;
+  *redirp = redir;
+  *nredirsp += 1;
+  uncat_saved++;
 }
 
-static bool is_pipeline(token_t *token, int ntokens)
+static bool is_pipeline(const token_t *token, int ntokens)
 {
   for (int i = 0; i < ntokens; i++)
-    if (token[i] == T_PIPE)
+    if (token[i].kind == T_PIPE)
       return true;
   return false;
 }
 
-static void eval(char *cmdline)
+/* Execute pipelines of a command line. Pipeline linked with '&&' is executed
+ * only if the previous one succeeded, and with '||' only if it failed.
+ * Skipped pipeline leaves exit status of the and-or list intact. */
+static int do_list(const char *line, const token_t *token,
+                   const redir_t *redir, const node_t *node, int nnodes)
+{
+  int exitcode = 0;
+
+  for (const node_t *nd = node; nd < node + nnodes; nd++)
+  {
+    if ((nd->link == T_AND && exitcode != 0) ||
+        (nd->link == T_OR && exitcode == 0))
+      continue;
+
+    const token_t *first = &token[nd->token];
+    if (is_pipeline(first, nd->ntokens))
+    {
+      int ntokens = nd->ntokens, nredirs = nd->nredirs;
+      const redir_t *rd = &redir[nd->redir];
+      if (uncat)
+        do_uncat(line, &first, &ntokens, &rd, &nredirs);
+      exitcode = do_pipeline(line, first, ntokens, rd, nredirs, nd->bg,
+                             nd->timed);
+    }
+    else
+      exitcode = do_job(line, first, nd->ntokens, &redir[nd->redir],
+                        nd->nredirs, nd->bg, nd->timed);
+
+    if (nd->negate)
+      exitcode = !exitcode;
+  }
+
+  return exitcode;
+}
+
+/* In-memory files made for here-documents of the command line being
+ * evaluated. */
+static int *heredoc_fds;
+static int nheredocs;
+
+/* Put here-string, or here-document made of input lines that precede a line
+ * with the delimiter, into in-memory file fd. File is sealed, so the command
+ * reading it cannot change it, and it never touches the filesystem. */
+static void mkheredoc(int fd, const char *word, size_t len, bool herestr)
 {
-  bool bg = false;
-  int ntokens;
-  token_t *token = tokenize(cmdline, &ntokens);
+  rio_wbuf_t wb;
 
-  if (ntokens > 0 && token[ntokens - 1] == T_BGJOB)
+  rio_writeinitb(&wb, fd);
+  if (herestr)
   {
-    token[--ntokens] = NULL;
-    bg = true;
+    Rio_writeb(&wb, word, len);
+    Rio_writeb(&wb, "\n", 1);
   }
+  else
+  {
+    const char *line;
+    size_t n;
 
-  if (ntokens > 0)
+    while (true)
+    {
+      if ((line = nextline(&n)) == NULL)
+      {
+        msg("here-document delimited by end of input (wanted '%.*s')\n",
+            (int)len, word);
+        break;
+      }
+      if (n == len && !memcmp(line, word, len))
+        break;
+      Rio_writeb(&wb, line, n);
+      Rio_writeb(&wb, "\n", 1);
+    }
+  }
+  Rio_flushb(&wb);
+
+  if (fcntl(fd, F_ADD_SEALS,
+            F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0)
+    unix_error("Fcntl error");
+  Lseek(fd, 0, SEEK_SET);
+}
+
+/* Bodies of here-documents follow the command line in the input, so they are
+ * read before any command is executed. Each one is turned into a redirection
+ * that duplicates an in-memory file, which works for spawned subprocesses and
+ * builtins alike. Returns redirections with here-documents replaced. Command
+ * line is copied as reading input may overwrite it. */
+static redir_t *heredocs(const char **linep, size_t len, redir_t *redir,
+                         int nredirs)
+{
+  redir_t *plan = redir;
+
+  for (int i = 0; i < nredirs; i++)
   {
-    if (is_pipeline(token, ntokens))
+    if (redir[i].dup != R_HEREDOC && redir[i].dup != R_HERESTR)
+      continue;
+    if (plan == redir)
     {
-      do_pipeline(token, ntokens, bg);
+      *linep = arena_strndup(&line_arena, *linep, len);
+      plan = arena_alloc(&line_arena, sizeof(redir_t) * nredirs);
+      memcpy(plan, redir, sizeof(redir_t) * nredirs);
+      heredoc_fds = arena_alloc(&line_arena, sizeof(int) * nredirs);
     }
-    else
+    int fd = movefd(Memfd_create("heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING));
+    heredoc_fds[nheredocs++] = fd;
+    mkheredoc(fd, *linep + plan[i].offset, plan[i].length,
+              plan[i].dup == R_HERESTR);
+    plan[i].dup = fd;
+  }
+
+  return plan;
+}
+
+static void closeheredocs(void)
+{
+  while (nheredocs > 0)
+    Close(heredoc_fds[--nheredocs]);
+}
+
+/* Execute command line of given length. Line is only read, hence it may be
+ * a part of a larger buffer, e.g. a script mapped into memory. */
+static void eval(const char *cmdline, size_t len)
+{
+  int nnodes;
+  token_t *token;
+  redir_t *redir;
+  node_t *node = parseline(&line_arena, cmdline, len, &token, &redir, &nnodes);
+
+  if (node != NULL)
+  {
+    if (nnodes > 0)
+      redir = heredocs(&cmdline, len, redir,
+                       node[nnodes - 1].redir + node[nnodes - 1].nredirs);
+    last_status = do_list(cmdline, token, redir, node, nnodes);
+    closeheredocs();
+  }
+  else
+  {
+    last_status = 2;
+  }
+  debug("eval: exit status %d\n", last_status);
+
+  debug("eval: %zu bytes in %zu allocations, %zu from heap\n",
+        line_arena.nbytes, line_arena.nallocs, line_arena.nmallocs);
+  arena_reset(&line_arena);
+}
+
+static char *input_line;
+static bool input_done;
+
+static void input_handler(char *line)
+{
+  rl_callback_handler_remove();
+  input_line = line;
+  input_done = true;
+}
+
+/* Read a line with readline's callback interface. Keystrokes are fed to it
+ * from the same event loop that keeps track of subprocesses. */
+static char *readcmd(const char *prompt)
+{
+  input_done = false;
+  rl_callback_handler_install(prompt, input_handler);
+  while (!input_done)
+    if (pollevents(STDIN_FILENO, -1))
+      rl_callback_read_char();
+  return input_line;
+}
+
+/* Continuation lines typed at the terminal. */
+static const char *ttyline(size_t *lenp)
+{
+  static char *line;
+
+  free(line);
+  if ((line = readcmd("> ")) == NULL)
+    return NULL;
+  *lenp = strlen(line);
+  return line;
+}
+
+/* Lines of command string given with -c option. */
+static const char *str_next, *str_end;
+
+static const char *strline(size_t *lenp)
+{
+  const char *line = str_next;
+
+  if (line == str_end)
+    return NULL;
+
+  const char *eol = memchr(line, '\n', str_end - line);
+  if (eol == NULL)
+    eol = str_end;
+  str_next = min(eol + 1, str_end);
+  *lenp = eol - line;
+  return line;
+}
+
+/* Script read through buffered reader. Lines are returned straight from
+ * reader's buffer, only a line longer than the buffer is put together in
+ * a separate one. */
+static rio_t script_rio;
+
+static const char *rioline(size_t *lenp)
+{
+  static char *buf = NULL;
+  size_t buflen = 0;
+
+  while (true)
+  {
+    char *line;
+    ssize_t n = Rio_readline_view(&script_rio, &line);
+    bool partial = n == RIO_BUFSIZE && line[n - 1] != '\n';
+
+    if (partial || buflen > 0)
     {
-      do_job(token, ntokens, bg);
+      buf = Realloc(buf, buflen + n);
+      memcpy(buf + buflen, line, n);
+      buflen += n;
+      if (partial)
+        continue;
+      line = buf;
+      n = buflen;
     }
+
+    if (n == 0)
+      return NULL;
+
+    if (line[n - 1] == '\n')
+      n--;
+    *lenp = n;
+    return line;
+  }
+}
+
+/* Large scripts are executed directly from memory mapping. Pages that were
+ * executed are dropped every SCRIPT_CHUNK bytes, so only the part of the script
+ * being executed takes up memory, regardless of script size. */
+#define SCRIPT_CHUNK (1024 * 1024)
+
+static char *map_start;   /* beginning of the mapping */
+static char *map_done;    /* pages below were dropped */
+static const char *map_next, *map_end;
+
+static const char *mapline(size_t *lenp)
+{
+  const char *line = map_next;
+
+  if (map_start == NULL)
+    return NULL;
+
+  if (line - map_done >= SCRIPT_CHUNK)
+  {
+    size_t n = (line - map_done) & ~(sysconf(_SC_PAGESIZE) - 1);
+    Madvise(map_done, n, MADV_DONTNEED);
+    map_done += n;
+  }
+
+  if (line == map_end)
+  {
+    Munmap(map_start, map_end - map_start);
+    map_next = map_end = map_done = map_start = NULL;
+    return NULL;
   }
 
-  free(token);
+  const char *eol = memchr(line, '\n', map_end - line);
+  if (eol == NULL)
+    eol = map_end;
+  map_next = min(eol + 1, map_end);
+  *lenp = eol - line;
+  return line;
+}
+
+/* Map script that is a regular file, so that lines are lexed in place
+ * without copying. Returns false if the file cannot be mapped. */
+static bool mapscript(int fd)
+{
+  struct stat sb;
+
+  Fstat(fd, &sb);
+  if (!S_ISREG(sb.st_mode) || sb.st_size == 0)
+    return false;
+
+  map_start = Mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  Madvise(map_start, sb.st_size, MADV_SEQUENTIAL);
+  map_done = map_start;
+  map_next = map_start;
+  map_end = map_start + sb.st_size;
+  return true;
+}
+
+/* Execute lines of non-interactive input until it ends. */
+static void runlines(void)
+{
+  const char *line;
+  size_t len;
+
+  while ((line = nextline(&len)) != NULL)
+  {
+    if (len > 0)
+      eval(line, len);
+    watchjobs(FINISHED);
+  }
 }
 
 int main(int argc, char *argv[])
 {
-  rl_initialize();
+  const char *command = NULL;
+  int fd = STDIN_FILENO;
+
+  if (argc > 1 && !strcmp(argv[1], "-c"))
+  {
+    if (argc < 3)
+    {
+      msg("%s: -c: option requires an argument\n", argv[0]);
+      return 2;
+    }
+    command = argv[2];
+  }
+  else if (argc > 1)
+  {
+    if ((fd = open(argv[1], O_RDONLY | O_CLOEXEC)) < 0)
+    {
+      msg("%s: %s\n", argv[1], strerror(errno));
+      return 127;
+    }
+    fd = movefd(fd);
+  }
+
+  /* Job control and line editing are used only when commands are typed. */
+  interactive = command == NULL && fd == STDIN_FILENO && isatty(fd);
 
   sigemptyset(&sigchld_mask);
   sigaddset(&sigchld_mask, SIGCHLD);
 
   initjobs();
 
+  if (!interactive)
+  {
+    if (command)
+    {
+      str_next = command;
+      str_end = command + strlen(command);
+      nextline = strline;
+    }
+    else if (mapscript(fd))
+    {
+      nextline = mapline;
+    }
+    else
+    {
+      rio_readinitb(&script_rio, fd);
+      nextline = rioline;
+    }
+    runlines();
+    shutdownjobs();
+    arena_destroy(&line_arena);
+    return last_status;
+  }
+
+  rl_initialize();
+
   Signal(SIGINT, sigint_handler);
   Signal(SIGTSTP, SIG_IGN);
   Signal(SIGTTIN, SIG_IGN);
   Signal(SIGTTOU, SIG_IGN);
 
+  nextline = ttyline;
+
   char *line;
   while (true)
   {
     if (!sigsetjmp(loop_env, 1))
     {
-      line = readline("# ");
+      line = readcmd("# ");
     }
     else
     {
+      redir_pop();
+      closeheredocs();
+      arena_reset(&line_arena);
+      rl_free_line_state();
+      rl_callback_sigcleanup();
+      rl_callback_handler_remove();
       msg("\n");
       continue;
     }
@@ -300,7 +1005,7 @@ int main(int argc, char *argv[])
     if (strlen(line))
     {
       add_history(line);
-      eval(line);
+      eval(line, strlen(line));
     }
     free(line);
     watchjobs(FINISHED);
@@ -308,6 +1013,7 @@ int main(int argc, char *argv[])
 
   msg("\n");
   shutdownjobs();
+  arena_destroy(&line_arena);
 
   return 0;
 }
@@ -2,6 +2,8 @@
 #define _SHELL_H_
 
 #include "csapp.h"
+#include "rio.h"
+#include <sys/resource.h>
 
 #define msg(...) dprintf(STDERR_FILENO, __VA_ARGS__)
 
@@ -11,23 +13,76 @@
 #define debug(...)
 #endif
 
-typedef char *token_t;
+/* Do not change those values or code will break! */
+typedef enum {
+  T_NULL = 0, /* end of token stream */
+  T_AND,
+  T_OR,
+  T_PIPE,
+  T_BGJOB,
+  T_COLON,
+  T_OUTPUT,
+  T_INPUT,
+  T_APPEND,
+  T_BANG,
+  T_WORD,
+} tokkind_t;
+
+/* Token refers to a slice of command line, which is never modified. */
+typedef struct token {
+  uint32_t offset; /* position of the first character in the line */
+  uint32_t length; /* number of characters */
+  uint8_t kind;    /* one of tokkind_t values */
+} token_t;
+
+#define separator_p(t) ((t).kind <= T_COLON)
+#define string_p(t) ((t).kind == T_WORD)
+#define redir_p(t)                                                             \
+  ((t).kind == T_INPUT || (t).kind == T_OUTPUT || (t).kind == T_APPEND)
+/* Process substitution <(...) or >(...) is a word beginning with operator. */
+#define procsub_p(line, t)                                                     \
+  (string_p(t) && ((line)[(t).offset] == '<' || (line)[(t).offset] == '>'))
+
+token_t *tokenize(arena_t *a, const char *line, size_t len, int *tokc_p);
+bool tokeq(const char *line, const token_t *tok, const char *str);
+char **mkargv(arena_t *a, const char *line, const token_t *token,
+              int ntokens);
+
+/* Redirection compiled from an operator and the word that follows it.
+ * Descriptors above 9 are not supported, so they belong to commands alone. */
+#define R_OPEN -1    /* open file named by the word */
+#define R_CLOSE -2   /* close the descriptor */
+#define R_HEREDOC -3 /* read lines up to the word from input */
+#define R_HERESTR -4 /* read the word itself */
+
+typedef struct redir {
+  uint32_t offset; /* position of the word in the line */
+  uint32_t length; /* number of characters of the word */
+  int flags;       /* flags to open the file with */
+  int8_t fd;       /* descriptor being redirected */
+  int16_t dup;     /* descriptor to duplicate or one of R_* actions */
+} redir_t;
 
-#define T_NULL ((token_t)0)
-#define T_AND ((token_t)1)
-#define T_OR ((token_t)2)
-#define T_PIPE ((token_t)3)
-#define T_BGJOB ((token_t)4)
-#define T_COLON ((token_t)5)
-#define T_OUTPUT ((token_t)6)
-#define T_INPUT ((token_t)7)
-#define T_APPEND ((token_t)8)
-#define T_BANG ((token_t)9)
-#define separator_p(t) ((t) <= T_COLON)
-#define string_p(t) ((t) > T_BANG)
+/* Pipeline of a command line together with operator that links it to the
+ * previous pipeline. Nodes are stored in a single array in order they appear
+ * on the command line, which is also the order of execution. */
+typedef struct node {
+  int token;    /* index of the first token of the pipeline */
+  int ntokens;  /* number of tokens in the pipeline */
+  uint8_t link; /* T_AND or T_OR, T_COLON if pipeline begins and-or list */
+  bool negate;  /* exit status is inverted by '!' */
+  bool timed;   /* resource usage is reported due to 'time' prefix */
+  bool bg;      /* pipeline is run in the background */
+  int redir;    /* index of the first redirection of the pipeline */
+  int nredirs;  /* number of redirections in the pipeline */
+} node_t;
 
-void strapp(char **dstp, const char *src);
-token_t *tokenize(char *s, int *tokc_p);
+node_t *parse(arena_t *a, const char *line, const token_t *token, int ntokens,
+              redir_t **redirp, int *nnodesp);
+node_t *parseline(arena_t *a, const char *line, size_t len, token_t **tokenp,
+                  redir_t **redirp, int *nnodesp);
+void flushlines(void);
+void prlinestats(int fd);
 
 /* Do not change those values or code will break! */
 enum {
@@ -46,19 +101,47 @@ enum {
 void initjobs(void);
 void shutdownjobs(void);
 
-int addjob(pid_t pgid, int bg);
+int addjob(pid_t pgid, int bg, int nproc);
 void addproc(int job, pid_t pid, char **argv);
 bool killjob(int job);
 void watchjobs(int state);
+void timejob(int job);
+void gettime(struct timeval *tv);
+void prtimes(rio_wbuf_t *wp, const char *label, const struct timeval *real,
+             const struct rusage *ru);
 int jobstate(int job, int *exitcodep);
 char *jobcmd(int job);
-bool resumejob(int job, int bg, sigset_t *mask);
-int monitorjob(sigset_t *mask);
+bool resumejob(int job, int bg);
+int monitorjob(void);
+bool pollevents(int fd, int timeout);
+void watchpipe(int job, int fd);
 
+bool builtin_p(const char *name);
+bool shell_builtin_p(const char *name);
 int builtin_command(char **argv);
-noreturn void external_command(char **argv);
+const char *findcommand(const char *name);
+noreturn void external_command(const char *path, char **argv);
 
-/* Used by Sigprocmask to enter critical section protecting against SIGCHLD. */
+/* SIGCHLD is kept blocked and is received through signalfd instead. */
 extern sigset_t sigchld_mask;
 
+/* Signal mask to be restored in subprocesses. */
+extern sigset_t child_mask;
+
+/* Controlling terminal, handed over to foreground jobs. */
+extern int tty_fd;
+int movefd(int fd);
+
+/* Interactive shell reads commands from a terminal and does job control. */
+extern bool interactive;
+
+/* Pipe capacity settings, changed with 'pipesize' builtin. */
+extern int pipe_size;
+extern bool pipe_adaptive;
+int pipe_max_size(void);
+
+/* Pipeline optimization settings, changed with 'uncat' builtin. */
+extern bool uncat;
+extern unsigned uncat_saved;
+
 #endif /* !_SHELL_H_ */
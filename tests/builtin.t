@@ -0,0 +1,29 @@
+# Builtins, run in the shell when possible, and external commands that share
+# their names.
+
+check 'kill -l falls back to /bin/kill' 'kill -l 9' 'KILL'
+check 'kill -l with redirection' 'kill -l 15 > k; cat k' 'TERM'
+check 'kill pid falls back to /bin/kill' 'kill 999999; echo after' \
+  'kill: (999999): No such process
+after'
+check 'kill unknown job' 'kill %7' 'kill: job not found: %7'
+check 'kill -l in pipeline' 'kill -l 9 | cat' 'KILL'
+check 'pipesize overflowing strtol' 'pipesize 99999999999999999999' \
+  'pipesize: invalid argument: 99999999999999999999'
+check 'pipesize overflowing when scaled' 'pipesize 9223372036854775807K' \
+  'pipesize: invalid argument: 9223372036854775807K'
+check 'pipesize above INT_MAX' 'pipesize 2048M' \
+  'pipesize: invalid argument: 2048M'
+
+# Line running linecache is looked up too, so it counts as one more miss.
+check_script 'linecache counts hits and misses' 'echo hi
+echo hi
+linecache' 'hi
+hi
+2 lines cached, 1 hits, 2 misses'
+check_script 'linecache -r resets counters' 'echo hi
+echo hi
+linecache -r
+linecache' 'hi
+hi
+1 lines cached, 0 hits, 1 misses'
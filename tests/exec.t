@@ -0,0 +1,8 @@
+# Starting external commands and exit statuses of those that cannot be run.
+
+check 'command not found' 'nosuchcmd' \
+  'nosuchcmd: No such file or directory'
+check_status 'not found exits with 127' 'nosuchcmd' 127
+check_status 'not executable exits with 126' '/etc' 126
+check_status 'exit status of command' 'ls nosuch' 2
+check_status 'success' '/bin/true' 0
@@ -0,0 +1,16 @@
+# Here-documents and here-strings, read from memfds that the shell keeps
+# above descriptor 9 until the command has them as its input.
+
+check 'here-string' 'cat <<<hello' 'hello'
+check 'here-document' 'cat <<EOF
+one
+two
+EOF' 'one
+two'
+check 'here-string to forked builtin' 'tee hx <<<hello; cat hx' 'hello
+hello'
+check 'here-document to forked builtin' 'tee <<EOF
+line
+EOF' 'line'
+check 'here-string to builtin in pipeline' 'jobs <<<hi | cat; echo ok' 'ok'
+check 'here-string to fd 3' 'tee 3<<<three <&3' 'three'
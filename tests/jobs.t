@@ -0,0 +1,17 @@
+# Job listings and notifications, written through a buffered writer. Failed
+# writes are dropped, as they were when dprintf was used.
+
+check 'jobs with closed stdout' \
+  'sleep 1 > /dev/null 2>&1 & jobs >&-; echo alive' 'alive'
+check 'jobs to full device' \
+  'sleep 1 > /dev/null 2>&1 & jobs > /dev/full; echo alive' 'alive'
+
+# Shell running -c command leaves its background jobs running when it exits.
+total=$((total + 1))
+rm -f later
+"$SHELL_UNDER_TEST" -c 'sleep 0.3 | wc -c > later &'
+sleep 0.6
+if [ "$(cat later)" != 0 ]; then
+  failed=$((failed + 1))
+  echo 'FAIL: background job killed when -c command finished'
+fi
@@ -0,0 +1,9 @@
+# Splitting command lines into words and operators. Scalar and vector code
+# paths must agree on which bytes end a word.
+
+check 'tab separates words' "$(printf 'echo a\tb')" 'a b'
+check 'vertical tab and form feed separate words' \
+  "$(printf 'echo a\vb\fc\rd')" 'a b c d'
+check 'operators end long words' \
+  'echo aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa|cat' \
+  'aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa'
@@ -0,0 +1,17 @@
+# Lists of pipelines joined with &&, || and ;, and negation with !.
+
+check 'and skips after failure' 'false && echo x' ''
+check 'and runs after success' 'true && echo x' 'x'
+check 'or runs after failure' 'false || echo y' 'y'
+check 'or skips after success' 'true || echo y' ''
+check 'and-or chain' 'false && echo x || echo y' 'y'
+check 'sequence runs both' 'false; echo z' 'z'
+check 'negated pipeline' '! echo a | grep b && echo n' 'n'
+check_status 'status of failed and' 'false && echo x' 1
+check_status 'status of skipped or' 'true || false' 0
+check_status 'status of negated success' '! true' 1
+check_status 'status of negated failure' '! false' 0
+check_status 'status of sequence is last' 'false; true' 0
+check_status 'status of sequence ending in failure' 'true; false' 1
+check 'background and-or list' 'true && echo a &' \
+  'background and-or lists are not supported'
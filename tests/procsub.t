@@ -0,0 +1,11 @@
+# Process substitution with <(...) and >(...).
+
+check 'input substitutions' 'cat <(echo a) <(echo b)' 'a
+b'
+check 'output substitution' 'echo x | tee >(wc -c)' 'x
+2'
+check 'substitutions as arguments' 'diff <(echo a) <(echo a) && echo same' \
+  'same'
+check 'unterminated substitution' 'cat <(echo a' \
+  "syntax error near unexpected token 'newline'"
+check_status 'status of unterminated substitution' 'cat <(echo a' 2
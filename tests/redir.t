@@ -0,0 +1,18 @@
+# Redirections, applied by posix_spawn file actions for external commands
+# and by do_redir in forked children and in the shell itself for builtins.
+
+check 'output to file' 'echo hi > f; cat f' 'hi'
+check 'append' 'echo a > f; echo b >> f; cat f' 'a
+b'
+check 'input from file' 'echo hi > f; cat < f' 'hi'
+check 'missing input' 'cat < nosuch' 'nosuch: No such file or directory'
+check 'stderr to stdout' 'ls nosuch 2>&1 | wc -l' '1'
+check 'close stdout' 'echo hi >&-' 'echo: write error: Bad file descriptor'
+check 'builtin in shell' 'uncat > f; echo x; cat f' 'x
+uncat off, 0 processes saved'
+check 'builtin to file' 'jobs > f; cat f' ''
+check_fd4 'external to fd 4' 'echo spawned >&4' 'spawned'
+check_fd4 'forked builtin to fd 4' 'tee >&4 < /etc/hostname' \
+  "$(cat /etc/hostname)"
+check_fd4 'forked builtin to fd 4 via 3' 'tee 3>&4 >&3 < /etc/hostname' \
+  "$(cat /etc/hostname)"
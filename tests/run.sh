@@ -0,0 +1,66 @@
+#!/bin/sh
+# Run command lines through the shell and compare what they print (both
+# stdout and stderr) with expected output. Cases live in tests/*.t files.
+# Usage: tests/run.sh [shell]
+
+SHELL_UNDER_TEST=$(realpath "${1:-./shell}")
+TESTS=$(realpath "$(dirname "$0")")
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+cd "$TMP" || exit 1
+
+failed=0
+total=0
+
+# check NAME COMMAND-LINE EXPECTED-OUTPUT
+check() {
+  total=$((total + 1))
+  actual=$("$SHELL_UNDER_TEST" -c "$2" 2>&1 4>fd4)
+  if [ "$actual" != "$3" ]; then
+    failed=$((failed + 1))
+    printf 'FAIL: %s\n  command:  %s\n  expected: %s\n  actual:   %s\n' \
+      "$1" "$2" "$3" "$actual"
+  fi
+}
+
+# check_script NAME SCRIPT EXPECTED-OUTPUT, where SCRIPT is read from stdin
+check_script() {
+  total=$((total + 1))
+  actual=$(printf '%s\n' "$2" | "$SHELL_UNDER_TEST" 2>&1)
+  if [ "$actual" != "$3" ]; then
+    failed=$((failed + 1))
+    printf 'FAIL: %s\n  script:   %s\n  expected: %s\n  actual:   %s\n' \
+      "$1" "$2" "$3" "$actual"
+  fi
+}
+
+# check_fd4 NAME COMMAND-LINE EXPECTED-CONTENTS-OF-FD-4
+check_fd4() {
+  total=$((total + 1))
+  "$SHELL_UNDER_TEST" -c "$2" >/dev/null 2>&1 4>fd4
+  actual=$(cat fd4)
+  if [ "$actual" != "$3" ]; then
+    failed=$((failed + 1))
+    printf 'FAIL: %s\n  command:  %s\n  expected: %s\n  actual:   %s\n' \
+      "$1" "$2" "$3" "$actual"
+  fi
+}
+
+# check_status NAME COMMAND-LINE EXPECTED-EXIT-STATUS
+check_status() {
+  total=$((total + 1))
+  "$SHELL_UNDER_TEST" -c "$2" >/dev/null 2>&1
+  actual=$?
+  if [ "$actual" != "$3" ]; then
+    failed=$((failed + 1))
+    printf 'FAIL: %s\n  command:  %s\n  expected status: %s\n  actual:   %s\n' \
+      "$1" "$2" "$3" "$actual"
+  fi
+}
+
+for t in "$TESTS"/*.t; do
+  . "$t"
+done
+
+echo "$((total - failed))/$total tests passed"
+[ "$failed" -eq 0 ]
@@ -0,0 +1,19 @@
+# The tee builtin: tee(2) and splice(2) for pipe input, read/write loop
+# otherwise, and the external tee for options it does not know.
+
+check 'tee from pipe' 'echo piped | tee o1 o2; cat o1 o2' 'piped
+piped
+piped'
+check 'tee from file' 'echo filed > f; tee o < f; cat o' 'filed
+filed'
+check 'tee from pipe to pipe' 'echo both | tee o | cat; cat o' 'both
+both'
+check 'tee -a' 'echo one > o; echo two | tee -a o > /dev/null; cat o' 'one
+two'
+check 'tee truncates' 'echo long line > o; echo x | tee o > /dev/null; cat o' \
+  'x'
+check 'tee unknown option falls back' \
+  'echo x | tee -i o; cat o; cat -- -i' 'x
+x
+cat: -i: No such file or directory'
+check 'tee --version falls back' 'tee --version | head -c 3' 'tee'
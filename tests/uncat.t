@@ -0,0 +1,21 @@
+# Rewriting 'cat file | cmd' to 'cmd < file' when uncat is enabled.
+
+check 'uncat rewrites cat pipeline' \
+  'printf a\nb\nc\n > f3; uncat -a; cat f3 | wc -l; uncat' '3
+uncat on, 1 processes saved'
+check 'uncat leaves pipeline without cat' \
+  'printf a\n > f1; uncat -a; wc -l < f1 | cat; uncat' '1
+uncat on, 0 processes saved'
+check 'uncat off keeps cat' \
+  'printf a\n > f1; cat f1 | wc -l; uncat' '1
+uncat off, 0 processes saved'
+check 'uncat -r resets counter' \
+  'printf a\n > f1; uncat -a; cat f1 | wc -l; uncat -r; uncat' '1
+uncat on, 0 processes saved'
+
+# Missing file is now reported by the shell opening it, not by cat, and the
+# rest of the pipeline does not run.
+check 'uncat with missing file' 'uncat -a; cat nosuch | wc -l' \
+  'nosuch: No such file or directory'
+check_status 'status of uncat with missing file' \
+  'uncat -a; cat nosuch | wc -l' 1